@@ -0,0 +1,78 @@
+#include "SPSocketAllocator.h"
+
+namespace SPSocket
+{
+    static std::size_t round_up_block(std::size_t size)
+    {
+        // Every block must be able to hold the free list link, and stay aligned.
+        const std::size_t align = alignof(std::max_align_t);
+        if (size < sizeof(void*))
+            size = sizeof(void*);
+        return (size + align - 1) / align * align;
+    }
+
+    void* SlabPool::Allocate(std::size_t size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+
+            if (block_size_ == 0)
+                block_size_ = round_up_block(size);
+
+            if (round_up_block(size) == block_size_)
+            {
+                if (!free_list_)
+                    add_slab();
+
+                free_block* block = free_list_;
+                free_list_ = block->next;
+                ++in_use_;
+                return block;
+            }
+        }
+        return ::operator new(size);
+    }
+
+    void SlabPool::Deallocate(void* pointer, std::size_t size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+
+            if (round_up_block(size) == block_size_)
+            {
+                free_block* block = static_cast<free_block*>(pointer);
+                block->next = free_list_;
+                free_list_ = block;
+                --in_use_;
+                return;
+            }
+        }
+        ::operator delete(pointer);
+    }
+
+    std::size_t SlabPool::InUse() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return in_use_;
+    }
+
+    std::size_t SlabPool::Capacity() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return slabs_.size() * blocks_per_slab_;
+    }
+
+    void SlabPool::add_slab()
+    {
+        // new char[] is aligned for any fundamental type, as is every block size.
+        slabs_.emplace_back(new char[block_size_ * blocks_per_slab_]);
+        char* slab = slabs_.back().get();
+
+        for (std::size_t i = blocks_per_slab_; i-- > 0;)
+        {
+            free_block* block = reinterpret_cast<free_block*>(slab + i * block_size_);
+            block->next = free_list_;
+            free_list_ = block;
+        }
+    }
+}
@@ -0,0 +1,179 @@
+#ifndef _SP_SOCKET_ALLOCATOR_H_
+#define _SP_SOCKET_ALLOCATOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// https://www.boost.org/doc/libs/1_78_0/doc/html/boost_asio/example/cpp11/allocation/server.cpp
+
+namespace SPSocket
+{
+    //
+    // Storage for the handler of one asynchronous operation at a time. An object
+    // that never has more than one operation of a kind outstanding, such as the
+    // read or the write of a session, keeps one of these per kind and wraps its
+    // handlers with MakeCustomAllocHandler(). Asio then builds the operation state
+    // in here instead of allocating it from the heap for every operation.
+    //
+    // Falls back to the heap if the storage is busy or too small. The handler may
+    // be built on another thread than it completes on, e.g. a drain posted by
+    // whoever fills an empty inbox, as long as two of them never overlap.
+    //
+    class HandlerMemory {
+    public:
+
+        HandlerMemory() = default;
+
+        HandlerMemory(const HandlerMemory&) = delete;
+        HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+        void* Allocate(std::size_t size)
+        {
+            if (size <= sizeof(storage_) && !in_use_.exchange(true, std::memory_order_acquire))
+                return &storage_;
+            return ::operator new(size);
+        }
+
+        void Deallocate(void* pointer)
+        {
+            if (pointer == &storage_)
+                in_use_.store(false, std::memory_order_release);
+            else
+                ::operator delete(pointer);
+        }
+
+    private:
+
+        typename std::aligned_storage<1024>::type storage_;
+        std::atomic<bool> in_use_{ false };
+    };
+
+    // The minimal allocator handed to Asio through a handler's allocator_type
+    template <typename T>
+    class HandlerAllocator {
+    public:
+
+        typedef T value_type;
+
+        explicit HandlerAllocator(HandlerMemory& mem) : memory_(mem) {}
+
+        template <typename U>
+        HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory_(other.memory_) {}
+
+        bool operator==(const HandlerAllocator& other) const noexcept { return &memory_ == &other.memory_; }
+        bool operator!=(const HandlerAllocator& other) const noexcept { return &memory_ != &other.memory_; }
+
+        T* allocate(std::size_t n) const { return static_cast<T*>(memory_.Allocate(sizeof(T) * n)); }
+        void deallocate(T* p, std::size_t /*n*/) const { memory_.Deallocate(p); }
+
+    private:
+
+        template <typename> friend class HandlerAllocator;
+
+        HandlerMemory& memory_;
+    };
+
+    // Wraps a handler so that Asio allocates its operation state from a HandlerMemory
+    template <typename Handler>
+    class CustomAllocHandler {
+    public:
+
+        typedef HandlerAllocator<Handler> allocator_type;
+
+        CustomAllocHandler(HandlerMemory& mem, Handler h) : memory_(mem), handler_(std::move(h)) {}
+
+        allocator_type get_allocator() const noexcept { return allocator_type(memory_); }
+
+        template <typename ...Args>
+        void operator()(Args&&... args) { handler_(std::forward<Args>(args)...); }
+
+    private:
+
+        HandlerMemory& memory_;
+        Handler handler_;
+    };
+
+    template <typename Handler>
+    inline CustomAllocHandler<Handler> MakeCustomAllocHandler(HandlerMemory& mem, Handler h)
+    {
+        return CustomAllocHandler<Handler>(mem, std::move(h));
+    }
+
+    //----------------------------------------------------------------------
+
+    //
+    // A free list of equally sized blocks, carved out of slabs of blocks_per_slab
+    // at a time. Meant for objects that come and go at a high rate, such as the
+    // sessions of one io_context during a reconnect wave: once warmed up, creating
+    // and destroying one is a mutex-protected pop and push instead of a call into
+    // the global allocator. The block size is fixed by the first allocation, any
+    // other size is passed on to the heap.
+    //
+    // Blocks may be freed from any thread, since the last reference to a shared
+    // object can be dropped anywhere. Slabs are only returned to the heap when the
+    // pool itself is destroyed.
+    //
+    class SlabPool {
+    public:
+
+        explicit SlabPool(std::size_t blocks_per_slab = 64) : blocks_per_slab_(blocks_per_slab > 0 ? blocks_per_slab : 1) {}
+
+        SlabPool(const SlabPool&) = delete;
+        SlabPool& operator=(const SlabPool&) = delete;
+
+        void* Allocate(std::size_t size);
+        void Deallocate(void* pointer, std::size_t size);
+
+        // Blocks currently handed out, and blocks allocated in total
+        std::size_t InUse() const;
+        std::size_t Capacity() const;
+
+    private:
+
+        struct free_block {
+            free_block* next;
+        };
+
+        void add_slab();
+
+        mutable std::mutex mtx_;
+        std::size_t blocks_per_slab_;
+        std::size_t block_size_ = 0;
+        std::size_t in_use_ = 0;
+        free_block* free_list_ = nullptr;
+        std::vector<std::unique_ptr<char[]>> slabs_;
+    };
+
+    // Allocator drawing from a SlabPool, for std::allocate_shared. Every copy shares
+    // ownership of the pool, so the pool outlives the last object allocated from it.
+    template <typename T>
+    class SlabAllocator {
+    public:
+
+        typedef T value_type;
+
+        explicit SlabAllocator(std::shared_ptr<SlabPool> pool) : pool_(std::move(pool)) {}
+
+        template <typename U>
+        SlabAllocator(const SlabAllocator<U>& other) noexcept : pool_(other.pool_) {}
+
+        bool operator==(const SlabAllocator& other) const noexcept { return pool_ == other.pool_; }
+        bool operator!=(const SlabAllocator& other) const noexcept { return pool_ != other.pool_; }
+
+        T* allocate(std::size_t n) const { return static_cast<T*>(pool_->Allocate(sizeof(T) * n)); }
+        void deallocate(T* p, std::size_t n) const { pool_->Deallocate(p, sizeof(T) * n); }
+
+    private:
+
+        template <typename> friend class SlabAllocator;
+
+        std::shared_ptr<SlabPool> pool_;
+    };
+}
+
+#endif
@@ -8,32 +8,107 @@
 
 #include "SPSocketClient.h"
 
+#include <algorithm>
 #include <iostream>
+#include <iterator>
 
 namespace SPSocket
 {
 	void SPSocketClient::Connect(const std::string& host, int port)
 	{
 		status = ConnectionStatus::S_CLOSED;
-		start(resolver_.resolve(host, std::to_string(port)));
-	}
+		stopped_ = false;
+		primary_host_ = { host, port };
+		host_index_ = 0;
+		reconnect_attempt_ = 0;
 
-	void SPSocketClient::start(tcp::resolver::results_type endpoints)
-	{
-		// Start the connect actor.
-		endpoints_ = endpoints;
-		start_connect(endpoints_.begin());
+		// Start the connect actor, once the host is resolved.
+		resolve(0);
 
 		// Start the deadline actor. You will note that we're not setting any
 		// particular deadline here. Instead, the connect and input actors will
-		// update the deadline prior to each asynchronous operation.
+		// update the deadline prior to each asynchronous operation. Until then it
+		// must not count as passed, a new timer's expiry is long gone.
+		deadline_.expires_at(steady_timer::time_point::max());
 		deadline_.async_wait(std::bind(&SPSocketClient::check_deadline, this, _1));
 	}
 
+	void SPSocketClient::resolve(std::size_t host_index)
+	{
+		host_index_ = host_index;
+		const auto& host = host_index == 0 ? primary_host_ : failover_hosts_[host_index - 1];
+
+		status = ConnectionStatus::S_CONNECTING;
+		lookup_ = ResolveCache::Shared().AsyncResolve(socket_.get_executor(), host.first, std::to_string(host.second),
+			[this](const boost::system::error_code& error, const tcp::resolver::results_type& results)
+		{
+			handle_resolve(error, results);
+		});
+	}
+
+	void SPSocketClient::handle_resolve(const boost::system::error_code& error, const tcp::resolver::results_type& results)
+	{
+		if (stopped_)
+			return;
+
+		if (error)
+		{
+			status = ConnectionStatus::S_CONNECT_ERROR;
+			OnConnectionError(error.message());
+
+			if (reconnect_)
+				try_next_host();
+			return;
+		}
+
+		endpoints_ = results;
+		start_connect(endpoints_.begin());
+	}
+
 	void SPSocketClient::UseReadUntil(char terminator)
 	{
 		use_read_until = true;
 		read_terminator = terminator;
+		codec_.UseDelimiter(terminator);
+	}
+
+	void SPSocketClient::UseLengthPrefix(std::size_t header_width, ByteOrder order)
+	{
+		use_read_until = false;
+		codec_.UseLengthPrefix(header_width, order);
+	}
+
+	void SPSocketClient::UseCompression(const std::string& dictionary)
+	{
+		codec_.UseCompressionFlag(true);
+		decompressor_.reset(new FrameDecompressor(dictionary));
+		dictionary_id_ = DictionaryId(dictionary);
+	}
+
+	void SPSocketClient::UsePollingToReceive(bool flag)
+	{
+		use_recv_polling = flag;
+		recv_ring_.Reset(flag ? recv_queue_capacity : 0);
+	}
+
+	void SPSocketClient::UseReceiveQueueCapacity(std::size_t msgs)
+	{
+		recv_queue_capacity = msgs;
+		if (use_recv_polling)
+			recv_ring_.Reset(msgs);
+	}
+
+	void SPSocketClient::UseReconnect(bool enable, int initial_delay_ms, int max_delay_ms, ReplayPolicy policy)
+	{
+		reconnect_ = enable;
+		reconnect_initial_ms = initial_delay_ms > 0 ? initial_delay_ms : 1;
+		reconnect_max_ms = max_delay_ms > reconnect_initial_ms ? max_delay_ms : reconnect_initial_ms;
+		replay_policy = policy;
+	}
+
+	void SPSocketClient::AddFailoverHost(const std::string& host, int port)
+	{
+		failover_hosts_.emplace_back(host, port);
 	}
 
 	void SPSocketClient::UseSendHeartBeat(int sec_interval, const std::string& heartbeat)
@@ -43,20 +118,90 @@ namespace SPSocket
 	}
 
 	void SPSocketClient::Disconnect()
+	{
+		stopped_ = true;
+		boost::system::error_code ignored_error;
+		reconnect_timer_.cancel(ignored_error);
+
+		// Abort a reconnect attempt in progress.
+		if (!running_ && reconnect_)
+			socket_.close(ignored_error);
+
+		close();
+	}
+
+	void SPSocketClient::close()
 	{
 		if (running_)
 		{
 			status = ConnectionStatus::S_CLOSED;
 			boost::system::error_code ignored_error;
 			socket_.close(ignored_error);
-			deadline_.cancel();
 			heartbeat_timer_.cancel();
 
+			// No deadline is left to time out, so none fires while reconnecting.
+			deadline_.expires_at(steady_timer::time_point::max());
+			metrics_->disconnects.Add();
+
+			// A write still in flight now belongs to a connection that is gone.
+			++connection_;
+
 			OnDisconnected();
 			running_ = false;
 		}
 	}
 
+	void SPSocketClient::drop_connection()
+	{
+		if (!running_)
+			return;
+
+		close();
+
+		// Try to get back right away, the backoff only starts once a whole round fails.
+		if (reconnect_ && !stopped_)
+		{
+			lost_at_ = std::chrono::steady_clock::now();
+			reconnect_attempt_ = 0;
+			reconnect();
+		}
+	}
+
+	void SPSocketClient::reconnect()
+	{
+		resolve(0);
+	}
+
+	void SPSocketClient::try_next_host()
+	{
+		// Every address of the current host has failed, on to the failover hosts.
+		if (host_index_ < failover_hosts_.size())
+			resolve(host_index_ + 1);
+		else
+			schedule_reconnect();
+	}
+
+	void SPSocketClient::schedule_reconnect()
+	{
+		// Exponential backoff, capped, with the delay picked at random between half
+		// and all of it, so clients dropped at the same time do not return in lockstep.
+		long long delay_ms = reconnect_initial_ms;
+		for (int i = 0; i < reconnect_attempt_ && delay_ms < reconnect_max_ms; ++i)
+			delay_ms *= 2;
+		delay_ms = std::min<long long>(delay_ms, reconnect_max_ms);
+		delay_ms = delay_ms / 2 + std::uniform_int_distribution<long long>(0, delay_ms - delay_ms / 2)(jitter_);
+
+		++reconnect_attempt_;
+		OnReconnecting(reconnect_attempt_, static_cast<int>(delay_ms));
+
+		reconnect_timer_.expires_after(std::chrono::milliseconds(delay_ms));
+		reconnect_timer_.async_wait([this](const boost::system::error_code& error)
+		{
+			if (!error && !stopped_)
+				reconnect();
+		});
+	}
+
 	void SPSocketClient::start_async_reading()
 	{
 		if (!IsConnected())
@@ -66,10 +211,30 @@ namespace SPSocket
 		{
 			running_ = true;
 
-			if (use_read_until)
-				start_read_until();
-			else
-				start_read();
+			// Drop anything left over from a previous connection, or send it now.
+			if (replay_policy == ReplayPolicy::R_DROP)
+				clear_send_queue();
+
+			frame_reader_.Clear();
+			recv_backlog_.clear();
+			read_parked_ = false;
+
+			// Ask for compression ahead of anything left to replay.
+			compressing_.store(false, std::memory_order_relaxed);
+			if (codec_.CompressionFlag())
+			{
+				std::string request = EncodeDictionaryId(codec_, dictionary_id_);
+				queued_bytes_.fetch_add(request.size(), std::memory_order_relaxed);
+				output_queue_.push_front(std::move(request));
+				request_queued_ = true;
+				if (!write_in_progress_)
+					start_write();
+			}
+
+			continue_read();
+
+			if (replay_policy == ReplayPolicy::R_REPLAY)
+				flush_send_queue();
 
 			if (heartbeat_str_.length() > 0)
 				send_heartbeat();
@@ -94,6 +259,11 @@ namespace SPSocket
 				std::bind(&SPSocketClient::handle_connect,
 					this, _1, endpoint_iter));
 		}
+		else if (reconnect_ && !stopped_)
+		{
+			// There are no more endpoints to try, move on to the next host.
+			try_next_host();
+		}
 		else
 		{
 			// There are no more endpoints to try. Shut down the client.
@@ -109,12 +279,15 @@ namespace SPSocket
 		// the timeout handler must have run first.
 		if (!socket_.is_open())
 		{
-			status = ConnectionStatus::S_CONNECT_ERROR;
-			OnConnectTimedOut(endpoint_iter->endpoint());			
-			return;
+			status = ConnectionStatus::S_CONNECT_TIMED_OUT;
+			if (stopped_)
+				return;
+
+			OnConnectTimedOut(endpoint_iter->endpoint());
 
 			// Try the next available endpoint.
-			//start_connect(++endpoint_iter);
+			if (reconnect_)
+				start_connect(++endpoint_iter);
 		}
 
 		// Check if the connect operation failed before the deadline expired.
@@ -127,15 +300,23 @@ namespace SPSocket
 			// before starting a new one.
 			socket_.close();
 
-			return;
 			// Try the next available endpoint.
-			//start_connect(++endpoint_iter);
+			if (reconnect_ && !stopped_)
+				start_connect(++endpoint_iter);
 		}
 
 		// Otherwise we have successfully established a connection.
 		else
 		{
 			status = ConnectionStatus::S_CONNECTED;
+			metrics_->connects.Add();
+			if (lost_at_ != std::chrono::steady_clock::time_point())
+			{
+				metrics_->reconnects.Add();
+				metrics_->reconnect_time.Record(std::chrono::steady_clock::now() - lost_at_);
+				lost_at_ = std::chrono::steady_clock::time_point();
+			}
+			reconnect_attempt_ = 0;
 			OnConnected(endpoint_iter->endpoint());
 
 			// Start the input actor.
@@ -154,15 +335,11 @@ namespace SPSocket
 			deadline_.expires_after(std::chrono::seconds(read_timeout));
 		}
 
-		// simulate memset 0
-		recv_buffer_.consume(recv_buffer_.size() + 1);
-
-		boost::asio::async_read(socket_, recv_buffer_,
-			boost::asio::transfer_at_least(1),
+		socket_.async_read_some(frame_reader_.Prepare(),
 			std::bind(&SPSocketClient::handle_read, this, _1, _2));
 	}
 
-	void SPSocketClient::start_read_until()
+	void SPSocketClient::start_read_frame()
 	{
 		if (!IsConnected())
 			return;
@@ -171,85 +348,264 @@ namespace SPSocket
 		{
 			// Set a deadline for the read operation.
 			deadline_.expires_after(std::chrono::seconds(read_timeout));
-		}	
+		}
 
-		// Start an asynchronous operation to read a newline-delimited message.
-		boost::asio::async_read_until(socket_,
-			boost::asio::dynamic_buffer(input_buffer_), read_terminator,
-			std::bind(&SPSocketClient::handle_read_until, this, _1, _2));
+		// Read whatever is available, the frames are cut out of the buffer afterwards.
+		socket_.async_read_some(frame_reader_.Prepare(),
+			std::bind(&SPSocketClient::handle_read_frame, this, _1, _2));
 	}
 
 	void SPSocketClient::handle_read(const boost::system::error_code& error, std::size_t n)
 	{
 		if (!error)
 		{
-			// Empty messages are heartbeats and so ignored.
-			if (n > 0)
-			{
-				boost::asio::streambuf::const_buffers_type bufs = recv_buffer_.data();
-				std::string str(boost::asio::buffers_begin(bufs),
-					boost::asio::buffers_begin(bufs) + recv_buffer_.size());
-
-				// Extract the delimited message from the buffer.
-				std::string str_recv(str.substr(0, n - 1));
+			frame_reader_.Commit(n);
+			metrics_->reads.Add();
+			metrics_->bytes_in.Add(n);
 
+			// Unframed reading hands out each chunk exactly as it was received.
+			std::string_view chunk = frame_reader_.TakeAll();
+			if (!chunk.empty())
+			{
+				metrics_->msgs_in.Add();
 				if (use_recv_polling)
-					push(str_recv);
+					push(chunk);
 				else
-					OnReceive(str_recv);
+					OnReceiveView(chunk);
 			}
-			start_read();
+
+			if (!recv_backlog_.empty())
+				resume_read();
+			else
+				start_read();
 		}
 		else
 		{
 			OnReceiveError(error.message());
-			Disconnect();
+			drop_connection();
 		}
 	}
 
-	void SPSocketClient::handle_read_until(const boost::system::error_code& error, std::size_t n)
+	void SPSocketClient::handle_read_frame(const boost::system::error_code& error, std::size_t n)
 	{
 		if (!error)
 		{
-			// Extract the delimited message from the buffer.
-			std::string str_recv(input_buffer_.substr(0, n - 1));
-			input_buffer_.erase(0, n);
+			frame_reader_.Commit(n);
+
+			// Cut every complete message out of the buffer in one pass, then hand
+			// them out as views straight into the receive buffer. Nothing is copied
+			// or allocated per message. Empty messages are heartbeats and so ignored.
+			frames_.clear();
+			FrameStatus status = frame_reader_.NextBatch(codec_, frames_);
+
+			metrics_->reads.Add();
+			metrics_->bytes_in.Add(n);
+			metrics_->frames_per_read.Record(frames_.size());
 
-			// Empty messages are heartbeats and so ignored.
-			if (!str_recv.empty())
+			for (std::string_view frame : frames_)
 			{
-				//std::thread([=] { OnReceive(str_recv); }).detach();		// use async callback instead, maybe dangerous
+				// Until the server has answered the request for compression, a
+				// flagged frame is the answer.
+				if (codec_.IsCompressed(frame.data()) && !compressing_.load(std::memory_order_relaxed))
+				{
+					if (!handle_compression_answer(frame))
+					{
+						OnReceiveError("invalid answer to the request for compression");
+						drop_connection();
+						return;
+					}
+					continue;
+				}
+
+				if (frame.empty())
+					continue;
+
+				if (codec_.IsCompressed(frame.data()))
+				{
+					if (!decompressor_->Decompress(frame, inflated_, codec_.MaxFrameSize()))
+					{
+						OnReceiveError("cannot decompress message");
+						drop_connection();
+						return;
+					}
+					metrics_->decompressed.Add();
+					frame = inflated_;
+				}
+
+				metrics_->msgs_in.Add();
 				if (use_recv_polling)
-					push(str_recv);
+					push(frame);
 				else
-					OnReceive(str_recv);
+					OnReceiveView(frame);
+			}
+
+			if (status == FrameStatus::F_OVERSIZED)
+			{
+				OnReceiveError("message exceeds the maximum frame size");
+				drop_connection();
+				return;
 			}
-			start_read_until();
+
+			if (!recv_backlog_.empty())
+				resume_read();
+			else
+				start_read_frame();
 		}
 		else
 		{
 			OnReceiveError(error.message());
-			Disconnect();
+			drop_connection();
 		}
 	}
 
-	void SPSocketClient::send(const std::string& content)
+	bool SPSocketClient::handle_compression_answer(std::string_view frame)
 	{
-		if (!IsConnected())
+		if (frame.empty())
+		{
+			compressing_.store(true, std::memory_order_relaxed);
+			return true;
+		}
+
+		// Refused, the server goes on sending plain messages.
+		std::uint32_t server_id = 0;
+		if (!DecodeDictionaryId(frame, server_id))
+			return false;
+
+		OnReceiveError(server_id == 0 ? "server does not compress" : "server compresses with another dictionary");
+		return true;
+	}
+
+	void SPSocketClient::send(std::string content)
+	{
+		// While reconnecting, messages are kept for the replay.
+		bool replay = reconnect_ && replay_policy == ReplayPolicy::R_REPLAY && !stopped_;
+		if (!IsConnected() && !replay)
 			return;
 
-		// Start an asynchronous operation to send a heartbeat message.
-		boost::asio::async_write(socket_, boost::asio::buffer(content, content.length()),
-			std::bind(&SPSocketClient::handle_send, this, _1));
+		// Account for the bytes before publishing the message, so the io_context
+		// thread can never subtract them first.
+		std::size_t size = content.size();
+		std::size_t queued = queued_bytes_.fetch_add(size, std::memory_order_relaxed) + size;
+		if (send_high_water_mark > 0 && queued > send_high_water_mark && queued - size <= send_high_water_mark)
+		{
+			metrics_->high_water_marks.Add();
+			OnSendHighWaterMark(queued);
+		}
+
+		// Only the first message since the last flush needs to wake the io_context,
+		// the others are picked up by that same flush.
+		if (send_queue_.Push(std::move(content)))
+			boost::asio::post(socket_.get_executor(), std::bind(&SPSocketClient::flush_send_queue, this));
 	}
 
-	void SPSocketClient::handle_send(const boost::system::error_code& error)
+	void SPSocketClient::flush_send_queue()
 	{
-		if (error)
+		send_queue_.Consume([this](std::string&& msg) { output_queue_.push_back(std::move(msg)); });
+
+		if (!write_in_progress_)
+			start_write();
+	}
+
+	void SPSocketClient::start_write()
+	{
+		if (!IsConnected() || output_queue_.empty())
+			return;
+
+		// Gather as many queued messages as the limits allow, always at least one.
+		// They are moved out of the queue and kept alive until the write completes.
+		in_flight_.clear();
+		in_flight_bytes_ = 0;
+		while (!output_queue_.empty())
+		{
+			std::string& msg = output_queue_.front();
+			if (!in_flight_.empty() &&
+				(in_flight_.size() >= write_max_buffers || in_flight_bytes_ + msg.size() > write_max_bytes))
+				break;
+
+			in_flight_bytes_ += msg.size();
+			in_flight_.push_back(std::move(msg));
+			output_queue_.pop_front();
+		}
+		request_queued_ = false;
+
+		write_buffers_.clear();
+		for (const auto& msg : in_flight_)
+			write_buffers_.push_back(boost::asio::buffer(msg));
+
+		// Start an asynchronous operation to send the gathered messages.
+		write_in_progress_ = true;
+		write_started_ = std::chrono::steady_clock::now();
+		boost::asio::async_write(socket_, write_buffers_,
+			std::bind(&SPSocketClient::handle_send, this, connection_, _1, _2));
+	}
+
+	void SPSocketClient::handle_send(std::uint64_t connection, const boost::system::error_code& error, std::size_t n)
+	{
+		write_in_progress_ = false;
+
+		if (connection != connection_)
+		{
+			// The connection was closed while the write was in flight, on purpose or
+			// after an error reported elsewhere. A new one may be waiting for it.
+			if (error)
+				requeue_in_flight();
+			else
+				queued_bytes_.fetch_sub(in_flight_bytes_, std::memory_order_relaxed);
+			in_flight_.clear();
+			start_write();
+		}
+		else if (!error)
+		{
+			metrics_->writes.Add();
+			metrics_->bytes_out.Add(n);
+			metrics_->msgs_out.Add(in_flight_.size());
+			metrics_->write_time.Record(std::chrono::steady_clock::now() - write_started_);
+
+			queued_bytes_.fetch_sub(in_flight_bytes_, std::memory_order_relaxed);
+			in_flight_.clear();
+
+			// Keep writing while there is more queued.
+			start_write();
+		}
+		else
 		{
+			requeue_in_flight();
+			if (replay_policy == ReplayPolicy::R_DROP)
+				clear_send_queue();
 			OnSendError(error.message());
-			Disconnect();
+			drop_connection();
+		}
+	}
+
+	void SPSocketClient::requeue_in_flight()
+	{
+		// A replay resends partly written messages in full, behind the compression
+		// request of a connection that is already up again.
+		if (replay_policy == ReplayPolicy::R_REPLAY)
+		{
+			auto pos = output_queue_.begin() + (request_queued_ ? 1 : 0);
+			output_queue_.insert(pos, std::make_move_iterator(in_flight_.begin()), std::make_move_iterator(in_flight_.end()));
 		}
+		else
+		{
+			queued_bytes_.fetch_sub(in_flight_bytes_, std::memory_order_relaxed);
+		}
+		in_flight_.clear();
+		in_flight_bytes_ = 0;
+	}
+
+	void SPSocketClient::clear_send_queue()
+	{
+		// A write in flight still counts until it completes.
+		send_queue_.Consume([](std::string&&) {});
+		output_queue_.clear();
+		queued_bytes_.store(write_in_progress_ ? in_flight_bytes_ : 0, std::memory_order_relaxed);
+	}
+
+	void SPSocketClient::UseWriteCoalescing(std::size_t max_bytes, std::size_t max_buffers)
+	{
+		write_max_bytes = max_bytes;
+		write_max_buffers = max_buffers > 0 ? max_buffers : 1;
 	}
 
 	void SPSocketClient::send_heartbeat()
@@ -257,23 +613,35 @@ namespace SPSocket
 		if (!IsConnected())
 			return;
 
-		// Start an asynchronous operation to send a heartbeat message.
-		boost::asio::async_write(socket_, boost::asio::buffer(heartbeat_str_, heartbeat_str_.length()),
-			std::bind(&SPSocketClient::handle_send_heartbeat, this, _1));
+		// Anything already queued proves liveness just as well, so the heartbeat
+		// is only queued when there is nothing else waiting to be sent.
+		if (output_queue_.empty())
+		{
+			if (codec_.Mode() == FramingMode::F_LENGTH_PREFIX)
+				output_queue_.push_back(codec_.Encode(std::string()));
+			else
+				output_queue_.push_back(heartbeat_str_);
+			queued_bytes_.fetch_add(output_queue_.back().length(), std::memory_order_relaxed);
+
+			if (!write_in_progress_)
+				start_write();
+		}
+
+		// Wait X seconds before sending the next heartbeat.
+		heartbeat_timer_.expires_after(std::chrono::seconds(hb_interval));
+		heartbeat_timer_.async_wait(std::bind(&SPSocketClient::handle_send_heartbeat, this, _1));
 	}
 
 	void SPSocketClient::handle_send_heartbeat(const boost::system::error_code& error)
 	{
 		if (!error)
 		{
-			// Wait X seconds before sending the next heartbeat.
-			heartbeat_timer_.expires_after(std::chrono::seconds(hb_interval));
-			heartbeat_timer_.async_wait(std::bind(&SPSocketClient::send_heartbeat, this));
+			send_heartbeat();
 		}
-		else
+		else if (error != boost::asio::error::operation_aborted)
 		{
 			OnHeartBeatError(error.message());
-			Disconnect();
+			drop_connection();
 		}
 	}
 
@@ -284,13 +652,19 @@ namespace SPSocket
 		// deadline before this actor had a chance to run.
 		if (deadline_.expiry() <= steady_timer::clock_type::now())
 		{
-			if (error)
+			// A deadline that passes completes the wait without an error, one that
+			// was moved or cancelled with operation_aborted.
+			if (!error)
 			{
-				OnReceiveTimeOut(error.message());
+				// handle_connect reports a connect that timed out.
+				metrics_->timeouts.Add();
+				if (status != ConnectionStatus::S_CONNECTING)
+					OnReceiveTimeOut("nothing received within the read timeout");
 
 				// The deadline has passed. The socket is closed so that any outstanding
 				// asynchronous operations are cancelled.
-				socket_.close();
+				boost::system::error_code ignored_error;
+				socket_.close(ignored_error);
 			}
 
 			// There is no longer an active deadline. The expiry is set to the
@@ -303,22 +677,103 @@ namespace SPSocket
 		deadline_.async_wait(std::bind(&SPSocketClient::check_deadline, this, _1));
 	}
 
-	void SPSocketClient::push(const std::string& data)
+	ClientMetricsSnapshot SPSocketClient::GetMetrics() const
 	{
-		std::lock_guard<std::mutex> lock(mtx_);
-		recv_queue_.push(data);
+		ClientMetricsSnapshot snapshot = metrics_->Snapshot();
+		snapshot.queued_bytes = queued_bytes_.load(std::memory_order_relaxed);
+		return snapshot;
 	}
 
-	void SPSocketClient::pop()
+	void SPSocketClient::continue_read()
 	{
-		std::string data = "";
-		{	// RAII
-			std::lock_guard<std::mutex> lock(mtx_);
-			if (recv_queue_.empty()) return;
-			data = recv_queue_.front();
-			recv_queue_.pop();
+		if (use_read_until || codec_.Mode() == FramingMode::F_LENGTH_PREFIX)
+			start_read_frame();
+		else
+			start_read();
+	}
+
+	void SPSocketClient::push(std::string_view data)
+	{
+		// Keep the order, nothing overtakes the backlog.
+		std::string* slot = recv_backlog_.empty() ? recv_ring_.Claim() : nullptr;
+		if (slot)
+		{
+			// Reuses whatever capacity the slot's string kept from earlier messages.
+			slot->assign(data.data(), data.size());
+			recv_ring_.Publish();
+		}
+		else
+		{
+			recv_backlog_.emplace_back(data);
 		}
-		OnReceive(data);			
 	}
-}
 
+	void SPSocketClient::resume_read()
+	{
+		for (;;)
+		{
+			std::string* slot = nullptr;
+			while (!recv_backlog_.empty() && (slot = recv_ring_.Claim()) != nullptr)
+			{
+				slot->swap(recv_backlog_.front());
+				recv_ring_.Publish();
+				recv_backlog_.pop_front();
+			}
+
+			if (recv_backlog_.empty())
+			{
+				read_parked_ = false;
+				continue_read();
+				return;
+			}
+
+			if (!read_parked_)
+			{
+				read_parked_ = true;
+				metrics_->recv_stalls.Add();
+
+				// No read is pending, so there is nothing for the deadline to time out.
+				deadline_.expires_at(steady_timer::time_point::max());
+			}
+
+			// Park until Poll() makes room. Poll() may have drained the ring before it
+			// could see the flag, so look again: whoever takes the flag back resumes.
+			recv_paused_.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (recv_ring_.Size() == recv_ring_.Capacity() || !recv_paused_.exchange(false))
+				return;
+		}
+	}
+
+	void SPSocketClient::after_poll(std::size_t count)
+	{
+		if (count == 0)
+			return;
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (recv_paused_.load(std::memory_order_relaxed) && recv_paused_.exchange(false))
+		{
+			boost::asio::post(socket_.get_executor(), [this]()
+			{
+				// Skip if the connection was dropped and started over meanwhile.
+				if (read_parked_ && IsConnected())
+					resume_read();
+			});
+		}
+	}
+
+	std::size_t SPSocketClient::Poll(std::size_t max_msgs)
+	{
+		// The messages are handed out in place and their slots keep the capacity.
+		std::size_t count = recv_ring_.Consume([this](std::string& msg) { OnReceive(msg); }, max_msgs);
+		after_poll(count);
+		return count;
+	}
+
+	std::size_t SPSocketClient::Poll(std::vector<std::string>& msgs, std::size_t max_msgs)
+	{
+		std::size_t count = recv_ring_.Consume([&msgs](std::string& msg) { msgs.push_back(std::move(msg)); }, max_msgs);
+		after_poll(count);
+		return count;
+	}
+}
@@ -2,19 +2,34 @@
 #ifndef _SP_SOCKET_CLIENT_H_
 #define _SP_SOCKET_CLIENT_H_
 
+// Older Boost versions use std::exchange in awaitable.hpp, which boost/asio.hpp
+// pulls in for C++20 builds, without including it.
+#include <utility>
+
 #include <boost/asio.hpp>
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/read.hpp>
-#include <boost/asio/read_until.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/write.hpp>
 //#include <boost/bind.hpp>
 
+#include <atomic>
+#include <deque>
 #include <functional>
-#include <queue>
+#include <memory>
+#include <random>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "SPSocketCompression.h"
+#include "SPSocketFraming.h"
+#include "SPSocketMetrics.h"
+#include "SPSocketMPSCQueue.h"
+#include "SPSocketResolveCache.h"
+#include "SPSocketSPSCQueue.h"
 
 // https://www.boost.org/doc/libs/1_78_0/doc/html/boost_asio/example/cpp11/timeouts/async_tcp_client.cpp
 
@@ -38,6 +53,13 @@ namespace SPSocket
 		S_CONNECT_TIMED_OUT
 	};
 
+	// What becomes of messages sent while the connection is down, see UseReconnect()
+	enum class ReplayPolicy
+	{
+		R_DROP,			// discard them once connected again
+		R_REPLAY		// send them, in order, once connected again
+	};
+
 	//
 	// This class manages socket timeouts by applying the concept of a deadline.
 	// Some asynchronous operations are given deadlines by which they must complete.
@@ -87,67 +109,184 @@ namespace SPSocket
 	//          |         |                        |          |
 	//  async_- |    +-------------+       async_- |    +--------------+
 	//   read_- |    |             |       write() |    |              |
-	//  until() +--->| handle_read |               +--->| handle_write |
+	//   some() +--->| handle_read |               +--->| handle_write |
 	//               |             |                    |              |
 	//               +-------------+                    +--------------+
 	//
 	// The input actor reads messages from the socket, where messages are delimited
 	// by the newline character. The deadline for a complete message is 30 seconds.
+	// Each read fills the free space of a receive buffer (FrameReader). Every
+	// complete message it then holds, delimited or length-prefixed, is extracted
+	// in one pass and handed to OnReceiveView() as a view into that buffer, so no
+	// string is built per message and no read is started while one is pending.
+	//
+	// With compression the client asks the server for compressed messages, with
+	// the id of its dictionary, as the first thing it sends on every connection.
+	// Once the server has accepted, the input actor inflates those that arrive
+	// compressed into a buffer of its own, reused from message to message, and
+	// hands them out like any other. A server that refuses, having no or another
+	// dictionary, keeps sending plain messages (see SPSocketCompression.h).
+	//
+	// In polling mode the input actor copies each message into a bounded lock-free
+	// single-producer / single-consumer ring instead, reusing the string a slot
+	// kept from earlier messages, and Poll() on the consumer thread drains it in
+	// batches without taking a lock. If the ring is full the input actor parks
+	// (no read pending) until Poll() has made room and wakes it.
 	//
 	// The heartbeat actor sends a heartbeat (a message that consists of a single
 	// newline character) every 10 seconds. In this example, no deadline is applied
 	// to message sending.
 	//
+	// All outbound data, user messages and heartbeats alike, goes through a single
+	// output queue drained by one write actor, so composed writes never overlap on
+	// the socket. Send() may be called from any thread and never blocks: it pushes
+	// onto a lock-free multi-producer queue, and only the producer that finds that
+	// queue empty posts a flush to the io_context. The flush moves the whole batch
+	// pending at that time into the output queue. The write actor then gathers as
+	// many queued messages as the coalescing limits allow into a single async_write:
+	//
+	//  +-------------------+
+	//  |                   |
+	//  | flush_send_queue  |
+	//  |                   |
+	//  +-------------------+
+	//           |
+	//           |  (if no write in flight)
+	//           V
+	//  +-------------+                    +-------------+
+	//  |             |   async_write()    |             |
+	//  | start_write |------------------->| handle_send |
+	//  |             |<-------------------|             |
+	//  +-------------+  (queue non-empty) +-------------+
+	//
+	// The gathered messages move out of the queue for the duration of the write,
+	// which is tagged with the connection it was started on. A write completing
+	// after its connection was closed is not reported as an error and leaves the
+	// queue of the next connection alone, save for putting back, for a replay,
+	// what it did not get to send.
+	//
 
 	class SPSocketClient {
 	public:
 
-		explicit SPSocketClient(boost::asio::io_context& io_context) : 
-			resolver_(io_context),
+		// Records into its own metrics unless given some to share, see UseMetrics()
+		explicit SPSocketClient(boost::asio::io_context& io_context, std::shared_ptr<ClientMetrics> metrics = nullptr) : 
+			status(ConnectionStatus::S_NOT_CONNECTED),
 			socket_(io_context), 
 			deadline_(io_context),
 			heartbeat_timer_(io_context),
-			recv_buffer_(), recv_queue_(), mtx_(), 
-			status(ConnectionStatus::S_NOT_CONNECTED)
+			reconnect_timer_(io_context),
+			jitter_(std::random_device()()),
+			metrics_(metrics ? std::move(metrics) : std::make_shared<ClientMetrics>())
 		{};
 
 		virtual ~SPSocketClient() noexcept {};
 
 		// Called by the user of the client class to initiate the connection process.
+		// Returns right away, the host is resolved asynchronously through the shared
+		// ResolveCache and a failure is reported to OnConnectionError().
 		void Connect(const std::string& host, int port);
 
+		// Reconnects by itself when the connection drops or cannot be made. Every
+		// resolved address of the host is tried, then those of each failover host.
+		// If all fail, the next round starts after a jittered delay that doubles from
+		// initial_delay_ms up to max_delay_ms. Messages not completely written when
+		// the connection dropped, and those sent while it is down, are dropped or
+		// sent again in full according to the policy. Disconnect() stops it.
+		void UseReconnect(bool enable, int initial_delay_ms = 50, int max_delay_ms = 5000,
+			ReplayPolicy policy = ReplayPolicy::R_DROP);
+
+		// Host to try when the one given to Connect() cannot be reached, in the order added.
+		// A host that does not answer at all is only left after the read timeout.
+		void AddFailoverHost(const std::string& host, int port);
+
 		// Async read until terminator detected, return string via OnReceive
 		void UseReadUntil(char terminator = '\n');
 
-		// Read timeout value in seconds, 0 = infinite (default)
+		// Binary framing: each message is preceded by a 2 or 4 byte length header.
+		// Received frames are decoded in place, Send() adds the header.
+		void UseLengthPrefix(std::size_t header_width = 4, ByteOrder order = ByteOrder::B_BIG_ENDIAN);
+
+		// Asks the server for compressed messages and decompresses them, see
+		// SPSocketServer::UseCompression, with the same dictionary. Only with a 4 byte
+		// length prefix, and needs SPSOCKET_WITH_ZLIB. Call after UseLengthPrefix(),
+		// before Connect().
+		void UseCompression(const std::string& dictionary);
+
+		// Whether the server accepted compression on the current connection
+		bool IsCompressing() const { return compressing_.load(std::memory_order_relaxed); }
+
+		// Read timeout value in seconds, 0 = infinite (default). Also bounds each connect
+		// attempt, so an address that does not answer is given up for the next one.
 		void UseReadTimeOut(int recv_timeout_sec) { read_timeout = recv_timeout_sec; }
 
-		// Sends heartbeat periodically to server
+		// Sends heartbeat periodically to server. In length-prefix mode the heartbeat is
+		// always an empty frame and the heartbeat string is ignored.
 		void UseSendHeartBeat(int sec_interval, const std::string& heartbeat = "\n");
 
 		// If true, receiving data will no longer push data to OnReceive(), instead, user needs to manually
 		// Poll() for data, which then can be read in OnReceive()
-		void UsePollingToReceive(bool flag) { use_recv_polling = flag; }
+		void UsePollingToReceive(bool flag);
+
+		// Messages the polling queue holds (default 4096, rounded up to a power of two).
+		// When it is full the client stops reading until Poll() makes room, leaving
+		// the rest to TCP flow control. Call before Connect().
+		void UseReceiveQueueCapacity(std::size_t msgs);
 
 		// Determines is there is a connected socket
 		bool IsConnected() const { return status == ConnectionStatus::S_CONNECTED; }
 
-		// Sends data over network to server
+		// Max bytes / buffers gathered into a single write (default 64KB / 64), max_buffers = 1 disables coalescing
+		void UseWriteCoalescing(std::size_t max_bytes, std::size_t max_buffers);
+
+		// OnSendHighWaterMark() is called once each time the queued outbound bytes rise
+		// above this mark, 0 = disabled (default)
+		void UseSendHighWaterMark(std::size_t bytes) { send_high_water_mark = bytes; }
+
+		// Bytes accepted by Send() but not yet written to the socket
+		std::size_t GetQueuedBytes() const { return queued_bytes_.load(std::memory_order_relaxed); }
+
+		// Sends data over network to server, safe to call from any thread
 		void Send(const std::vector<char>& buf) { std::string str(buf.data(), buf.size()); Send(str); }
 		void Send(const char* buf, size_t size) { std::string str(buf, size); Send(str); }
-		void Send(const std::string& content) { send(content); }
+		void Send(const std::string& content) { send(codec_.Encode(content)); }
 
-		// Polls for data received through socket through OnReceive()
-		void Poll() { pop(); }
+		// Polls for data received through socket through OnReceive(), up to max_msgs
+		// messages in one go, and returns how many there were. Call from one thread only.
+		std::size_t Poll(std::size_t max_msgs = 1);
+		std::size_t PollAll() { return Poll(SIZE_MAX); }
+
+		// The same, but moves the messages into msgs instead of calling OnReceive()
+		std::size_t Poll(std::vector<std::string>& msgs, std::size_t max_msgs = SIZE_MAX);
 
 		// This function terminates all the actors to shut down the connection. It
 		// may be called by the user of the client class, or by the class itself in
-		// response to graceful termination or an unrecoverable error.
+		// response to graceful termination or an unrecoverable error. It also stops
+		// reconnecting, until the next Connect().
 		void Disconnect();
 
 		// Gets current connection status
 		ConnectionStatus GetConnectionStatus() { return status; }
 
+		// Counters and histograms since construction, safe to call from any thread
+		ClientMetricsSnapshot GetMetrics() const;
+
+		// Records into these metrics instead of the client's own, e.g. one instance
+		// shared by a whole pool of clients, see SPSocketClientPool. GetMetrics() then
+		// reports the totals. Call before Connect().
+		void UseMetrics(const std::shared_ptr<ClientMetrics>& metrics) { metrics_ = metrics; }
+
+		// The same as text
+		std::string DumpMetrics() const { return FormatMetrics(GetMetrics()); }
+
+		// Called from the thread calling Send() when the queued outbound bytes cross the
+		// high-water mark, see UseSendHighWaterMark()
+		virtual void OnSendHighWaterMark(std::size_t /*queued_bytes*/) {}
+
+		// Called when a whole round of reconnect attempts failed, before waiting
+		// delay_ms for the next one, see UseReconnect()
+		virtual void OnReconnecting(int /*attempt*/, int /*delay_ms*/) {}
+
 	public:
 
 		// Client shall extend from this class and will need to override following methods
@@ -162,36 +301,57 @@ namespace SPSocket
 		virtual void OnSendError(const std::string& msg) = 0;
 		virtual void OnDisconnected() = 0;
 
+		// Override to get length-prefixed frames without copying them into a string,
+		// the view is only valid for the duration of the call. Forwards to OnReceive.
+		virtual void OnReceiveView(std::string_view msg) { OnReceive(std::string(msg)); }
+
 	private:
 
-		// The endpoints will have been obtained using a tcp::resolver.
-		void start(tcp::resolver::results_type endpoints);
+		// The endpoints will have been obtained through the process-wide
+		// ResolveCache. The client's own lookup is dropped with the client, so a
+		// result arriving later is never handed to it.
+		void resolve(std::size_t host_index);
+		void handle_resolve(const boost::system::error_code& error, const tcp::resolver::results_type& results);
 		void start_connect(tcp::resolver::results_type::iterator endpoint_iter);
 		void handle_connect(const boost::system::error_code& error,
 			tcp::resolver::results_type::iterator endpoint_iter);
 
 		void start_read();
-		void start_read_until();
+		void start_read_frame();
 		void start_async_reading();
 		void handle_read(const boost::system::error_code& error, std::size_t n);
-		void handle_read_until(const boost::system::error_code& error, std::size_t n);
+		void handle_read_frame(const boost::system::error_code& error, std::size_t n);
+		bool handle_compression_answer(std::string_view frame);
 
-		void send(const std::string& content);
+		void send(std::string content);
 		void send_heartbeat();
+		void flush_send_queue();
+		void start_write();
+		void clear_send_queue();
+		void requeue_in_flight();
 
-		void handle_send(const boost::system::error_code& error);
+		void handle_send(std::uint64_t connection, const boost::system::error_code& error, std::size_t n);
 		void handle_send_heartbeat(const boost::system::error_code& error);
 
-		void push(const std::string& data);		// enqueues
-		void pop();								// dequeues
+		void push(std::string_view data);		// enqueues for Poll()
+		void continue_read();
+		void resume_read();
+		void after_poll(std::size_t count);
 
 		void check_deadline(const boost::system::error_code& error);
 
+		void close();
+		void drop_connection();				// lost, reconnects if enabled
+		void reconnect();
+		void try_next_host();
+		void schedule_reconnect();
+
 	private:
 
-		ConnectionStatus status;
+		std::atomic<ConnectionStatus> status;
 
 		bool running_ = false;
+		bool write_in_progress_ = false;
 		bool use_read_until = false;
 		bool use_recv_polling = false;
 		
@@ -199,20 +359,60 @@ namespace SPSocket
 		int read_timeout = 0;
 		int hb_interval = 30;
 
+		std::size_t write_max_bytes = 64 * 1024;
+		std::size_t write_max_buffers = 64;
+		std::size_t send_high_water_mark = 0;
+		std::size_t recv_queue_capacity = 4096;
+
+		bool reconnect_ = false;
+		std::atomic<bool> stopped_{ false };		// Disconnect() called
+		int reconnect_initial_ms = 50;
+		int reconnect_max_ms = 5000;
+		int reconnect_attempt_ = 0;
+		ReplayPolicy replay_policy = ReplayPolicy::R_DROP;
+
+		std::pair<std::string, int> primary_host_;
+		std::vector<std::pair<std::string, int>> failover_hosts_;
+		std::size_t host_index_ = 0;				// 0 = primary, then the failover hosts
+		std::chrono::steady_clock::time_point lost_at_;
+
 		std::string heartbeat_str_ = "";
-		std::string input_buffer_ = "";
-		std::queue<std::string> recv_queue_;
 
-		tcp::resolver resolver_;
+		FrameCodec codec_;
+		FrameReader frame_reader_;
+		std::vector<std::string_view> frames_;
+		std::unique_ptr<FrameDecompressor> decompressor_;
+		std::uint32_t dictionary_id_ = 0;
+		std::atomic<bool> compressing_{ false };	// accepted on this connection
+		std::string inflated_;						// the last message decompressed
+
+		ResolveCache::lookup_ptr lookup_;
 		tcp::resolver::results_type endpoints_;
 		tcp::socket socket_;
 
 		steady_timer deadline_;
 		steady_timer heartbeat_timer_;
-
-		std::mutex mtx_;
-
-		boost::asio::streambuf recv_buffer_;
+		steady_timer reconnect_timer_;
+		std::minstd_rand jitter_;
+
+		// Polling mode: the io_context thread fills the ring and Poll() drains it.
+		// What does not fit waits in the backlog while reading is parked.
+		SPSCQueue<std::string> recv_ring_{ 0 };		// sized by UsePollingToReceive()
+		std::deque<std::string> recv_backlog_;		// owned by the io_context thread
+		bool read_parked_ = false;					// owned by the io_context thread
+		std::atomic<bool> recv_paused_{ false };	// set while parked, taken by Poll()
+
+		MPSCQueue<std::string> send_queue_;			// filled by Send() from any thread
+		std::deque<std::string> output_queue_;		// owned by the io_context thread
+		std::vector<std::string> in_flight_;		// taken off the queue by the write in progress
+		std::size_t in_flight_bytes_ = 0;
+		std::vector<boost::asio::const_buffer> write_buffers_;
+		std::atomic<std::size_t> queued_bytes_{ 0 };
+		std::uint64_t connection_ = 0;				// bumped by close(), tags each write
+		bool request_queued_ = false;				// compression request at the front of the queue
+
+		std::shared_ptr<ClientMetrics> metrics_;
+		std::chrono::steady_clock::time_point write_started_;
 	};
 }
 
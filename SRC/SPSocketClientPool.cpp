@@ -0,0 +1,237 @@
+#include "SPSocketClientPool.h"
+
+#include <algorithm>
+
+namespace SPSocket
+{
+	// One connection of the pool, forwards its callbacks with its index
+	class SPSocketClientPool::connection : public SPSocketClient {
+	public:
+
+		connection(boost::asio::io_context& io_context, SPSocketClientPool& pool, std::size_t index) :
+			SPSocketClient(io_context, pool.metrics_),
+			io_context_(io_context),
+			pool_(pool),
+			index_(index)
+		{}
+
+		boost::asio::io_context& GetIOContext() { return io_context_; }
+
+		void OnConnecting(const endpoint_type& /*ep*/) override {}
+		void OnConnected(const endpoint_type& ep) override { pool_.OnConnected(index_, ep); }
+		void OnConnectTimedOut(const endpoint_type& /*ep*/) override { pool_.OnError(index_, "Connect timed out"); }
+		void OnConnectionError(const std::string& msg) override { pool_.OnError(index_, msg); }
+		void OnHeartBeatError(const std::string& msg) override { pool_.OnError(index_, msg); }
+		void OnReceiveTimeOut(const std::string& msg) override { pool_.OnError(index_, msg); }
+		void OnReceiveError(const std::string& msg) override { pool_.OnError(index_, msg); }
+		void OnSendError(const std::string& msg) override { pool_.OnError(index_, msg); }
+		void OnDisconnected() override { pool_.OnDisconnected(index_); }
+
+		void OnReceive(const std::string& msg) override { pool_.OnReceive(index_, msg); }
+		void OnReceiveView(std::string_view msg) override { pool_.OnReceive(index_, msg); }
+
+	private:
+
+		boost::asio::io_context& io_context_;
+		SPSocketClientPool& pool_;
+		std::size_t index_;
+	};
+
+	SPSocketClientPool::SPSocketClientPool(std::size_t thread_count, bool pin_threads) :
+		io_context_pool_(std::max<std::size_t>(thread_count, 1), pin_threads),
+		metrics_(std::make_shared<ClientMetrics>(Histogram::shared_shard_count)),
+		connections_(std::make_shared<const connection_list>())
+	{
+		io_context_pool_.Run();
+	}
+
+	SPSocketClientPool::~SPSocketClientPool() noexcept
+	{
+		Stop();
+	}
+
+	void SPSocketClientPool::UseReadUntil(char terminator)
+	{
+		use_read_until = true;
+		use_length_prefix = false;
+		read_terminator = terminator;
+	}
+
+	void SPSocketClientPool::UseLengthPrefix(std::size_t width, ByteOrder order)
+	{
+		use_read_until = false;
+		use_length_prefix = true;
+		header_width = width;
+		byte_order = order;
+	}
+
+	void SPSocketClientPool::UseCompression(const std::string& dictionary)
+	{
+		use_compression = true;
+		dictionary_ = dictionary;
+	}
+
+	void SPSocketClientPool::UseSendHeartBeat(int sec_interval, const std::string& heartbeat)
+	{
+		hb_interval = sec_interval;
+		heartbeat_str_ = heartbeat;
+	}
+
+	void SPSocketClientPool::UseWriteCoalescing(std::size_t max_bytes, std::size_t max_buffers)
+	{
+		write_max_bytes = max_bytes;
+		write_max_buffers = max_buffers;
+	}
+
+	void SPSocketClientPool::UseReconnect(bool enable, int initial_delay_ms, int max_delay_ms, ReplayPolicy policy)
+	{
+		reconnect_ = enable;
+		reconnect_initial_ms = initial_delay_ms;
+		reconnect_max_ms = max_delay_ms;
+		replay_policy = policy;
+	}
+
+	void SPSocketClientPool::AddFailoverHost(const std::string& host, int port)
+	{
+		failover_hosts_.emplace_back(host, port);
+	}
+
+	std::size_t SPSocketClientPool::Connect(const std::string& host, int port, std::size_t connections)
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+
+		// Senders keep using the old list until the new one is published.
+		connection_list_ptr current = std::atomic_load(&connections_);
+		auto list = std::make_shared<connection_list>(*current);
+		std::size_t first = list->size();
+
+		for (std::size_t i = 0; i < connections; ++i)
+		{
+			auto c = std::make_shared<connection>(io_context_pool_.GetIOContext(), *this, first + i);
+			c->UseReadTimeOut(read_timeout);
+			c->UseWriteCoalescing(write_max_bytes, write_max_buffers);
+
+			if (use_read_until)
+				c->UseReadUntil(read_terminator);
+			else if (use_length_prefix)
+				c->UseLengthPrefix(header_width, byte_order);
+
+			if (use_compression)
+				c->UseCompression(dictionary_);
+
+			if (hb_interval > 0)
+				c->UseSendHeartBeat(hb_interval, heartbeat_str_);
+
+			c->UseReconnect(reconnect_, reconnect_initial_ms, reconnect_max_ms, replay_policy);
+			for (const auto& failover : failover_hosts_)
+				c->AddFailoverHost(failover.first, failover.second);
+
+			list->push_back(c);
+		}
+
+		std::atomic_store(&connections_, connection_list_ptr(std::move(list)));
+
+		// Each connection starts on its own io_context thread.
+		connection_list_ptr published = std::atomic_load(&connections_);
+		for (std::size_t i = first; i < published->size(); ++i)
+		{
+			connection* c = (*published)[i].get();
+			boost::asio::post(c->GetIOContext(), [c, host, port]() { c->Connect(host, port); });
+		}
+		return first;
+	}
+
+	void SPSocketClientPool::Disconnect()
+	{
+		connection_list_ptr list = std::atomic_load(&connections_);
+		for (const auto& c : *list)
+		{
+			connection* p = c.get();
+			boost::asio::post(p->GetIOContext(), [p]() { p->Disconnect(); });
+		}
+	}
+
+	void SPSocketClientPool::Stop()
+	{
+		io_context_pool_.Stop();
+
+		// No thread runs the connections any more, close them from here.
+		connection_list_ptr list = std::atomic_load(&connections_);
+		for (const auto& c : *list)
+			c->Disconnect();
+	}
+
+	bool SPSocketClientPool::healthy(const connection& c) const
+	{
+		std::size_t limit = max_queued_bytes.load(std::memory_order_relaxed);
+		return c.IsConnected() && (limit == 0 || c.GetQueuedBytes() < limit);
+	}
+
+	bool SPSocketClientPool::Send(const std::string& msg)
+	{
+		connection_list_ptr list = std::atomic_load(&connections_);
+		std::size_t count = list->size();
+		if (count == 0)
+			return false;
+
+		std::size_t start = next_connection_.fetch_add(1, std::memory_order_relaxed);
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			connection& c = *(*list)[(start + i) % count];
+			if (healthy(c))
+			{
+				c.Send(msg);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool SPSocketClientPool::Send(std::size_t index, const std::string& msg)
+	{
+		connection_list_ptr list = std::atomic_load(&connections_);
+		if (index >= list->size() || !healthy(*(*list)[index]))
+			return false;
+
+		(*list)[index]->Send(msg);
+		return true;
+	}
+
+	std::size_t SPSocketClientPool::Size() const
+	{
+		return std::atomic_load(&connections_)->size();
+	}
+
+	std::size_t SPSocketClientPool::ConnectedCount() const
+	{
+		connection_list_ptr list = std::atomic_load(&connections_);
+		return std::count_if(list->begin(), list->end(),
+			[](const std::shared_ptr<connection>& c) { return c->IsConnected(); });
+	}
+
+	bool SPSocketClientPool::IsHealthy(std::size_t index) const
+	{
+		connection_list_ptr list = std::atomic_load(&connections_);
+		return index < list->size() && healthy(*(*list)[index]);
+	}
+
+	ClientPoolMetricsSnapshot SPSocketClientPool::GetMetrics() const
+	{
+		ClientPoolMetricsSnapshot snapshot;
+		snapshot.clients = metrics_->Snapshot();
+
+		connection_list_ptr list = std::atomic_load(&connections_);
+		snapshot.connections = list->size();
+		for (const auto& c : *list)
+		{
+			snapshot.clients.queued_bytes += c->GetQueuedBytes();
+			if (c->IsConnected())
+			{
+				++snapshot.connected;
+				if (!healthy(*c))
+					++snapshot.saturated;
+			}
+		}
+		return snapshot;
+	}
+}
@@ -0,0 +1,142 @@
+#ifndef _SP_SOCKET_CLIENT_POOL_H_
+#define _SP_SOCKET_CLIENT_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "SPSocketClient.h"
+#include "SPSocketIOContextPool.h"
+#include "SPSocketMetrics.h"
+
+namespace SPSocket
+{
+	//
+	// Many upstream connections driven by one IOContextPool, e.g. a gateway
+	// holding hundreds or thousands of SPSocketClient connections. Connections
+	// are spread round-robin over the pool's threads, so the handlers of each
+	// still run on a single thread, and are configured once for the whole pool.
+	//
+	// Send() load-balances: each call starts one connection further along and
+	// takes the first healthy one, i.e. connected and with less than the queue
+	// limit waiting to be written. A connection that is down or backed up
+	// is skipped, not queued to:
+	//
+	//   Send() --> [0: down] [1: ok] [2: backed up] [3: ok] ...
+	//                  skip     ^ take    skip
+	//
+	// All connections record into one shared ClientMetrics, which gives the
+	// aggregate throughput and keeps the per-connection footprint to the client
+	// itself plus its receive buffer. The queue limit bounds what each connection
+	// can tie up in unsent data.
+	//
+	// The list of connections is copy-on-write, so Send() never waits for
+	// Connect() to add more.
+	//
+	class SPSocketClientPool {
+	public:
+
+		explicit SPSocketClientPool(std::size_t thread_count = std::thread::hardware_concurrency(), bool pin_threads = false);
+
+		virtual ~SPSocketClientPool() noexcept;
+
+		SPSocketClientPool(const SPSocketClientPool&) = delete;
+		SPSocketClientPool& operator=(const SPSocketClientPool&) = delete;
+
+		// Options for the connections opened afterwards, see SPSocketClient
+		void UseReadUntil(char terminator = '\n');
+		void UseLengthPrefix(std::size_t header_width = 4, ByteOrder order = ByteOrder::B_BIG_ENDIAN);
+		void UseCompression(const std::string& dictionary);
+		void UseReadTimeOut(int recv_timeout_sec) { read_timeout = recv_timeout_sec; }
+		void UseSendHeartBeat(int sec_interval, const std::string& heartbeat = "\n");
+		void UseWriteCoalescing(std::size_t max_bytes, std::size_t max_buffers);
+		void UseReconnect(bool enable, int initial_delay_ms = 50, int max_delay_ms = 5000,
+			ReplayPolicy policy = ReplayPolicy::R_DROP);
+		void AddFailoverHost(const std::string& host, int port);
+
+		// A connection with this much or more waiting to be written is skipped by
+		// Send() (default 1MB, 0 = no limit). Safe to call from any thread.
+		void UseMaxQueuedBytes(std::size_t bytes) { max_queued_bytes.store(bytes, std::memory_order_relaxed); }
+
+		// Opens more connections to host:port and returns the index of the first,
+		// the connections are numbered in the order they were opened
+		std::size_t Connect(const std::string& host, int port, std::size_t connections = 1);
+
+		// Closes every connection, they stay in the pool and do not reconnect
+		void Disconnect();
+
+		// Closes every connection and stops the threads, no callback runs after it
+		// returns. Call it from the destructor of the derived class, the destructor
+		// here is too late for the overridden callbacks.
+		void Stop();
+
+		// Sends on the next healthy connection, false if there is none. Safe to call
+		// from any thread.
+		bool Send(const std::string& msg);
+
+		// Sends on this connection if it is healthy, for messages that must stay in order
+		bool Send(std::size_t connection, const std::string& msg);
+
+		// Number of connections opened
+		std::size_t Size() const;
+
+		std::size_t ConnectedCount() const;
+		bool IsHealthy(std::size_t connection) const;
+
+		// Totals over all connections, safe to call from any thread
+		ClientPoolMetricsSnapshot GetMetrics() const;
+
+		// The same as text
+		std::string DumpMetrics() const { return FormatMetrics(GetMetrics()); }
+
+	public:
+
+		// Called on the connection's io_context thread. Override OnReceive, the rest is optional.
+		virtual void OnReceive(std::size_t connection, std::string_view msg) = 0;
+		virtual void OnConnected(std::size_t /*connection*/, const endpoint_type& /*ep*/) {}
+		virtual void OnDisconnected(std::size_t /*connection*/) {}
+		virtual void OnError(std::size_t /*connection*/, const std::string& /*msg*/) {}
+
+	private:
+
+		class connection;
+		typedef std::vector<std::shared_ptr<connection>> connection_list;
+		typedef std::shared_ptr<const connection_list> connection_list_ptr;
+
+		bool healthy(const connection& c) const;
+
+		bool use_read_until = false;
+		char read_terminator = '\n';
+		bool use_length_prefix = false;
+		std::size_t header_width = 4;
+		ByteOrder byte_order = ByteOrder::B_BIG_ENDIAN;
+		bool use_compression = false;
+		std::string dictionary_;
+		int read_timeout = 0;
+		int hb_interval = 0;
+		std::string heartbeat_str_;
+		std::size_t write_max_bytes = 64 * 1024;
+		std::size_t write_max_buffers = 64;
+		bool reconnect_ = false;
+		int reconnect_initial_ms = 50;
+		int reconnect_max_ms = 5000;
+		ReplayPolicy replay_policy = ReplayPolicy::R_DROP;
+		std::vector<std::pair<std::string, int>> failover_hosts_;
+		std::atomic<std::size_t> max_queued_bytes{ 1024 * 1024 };
+
+		IOContextPool io_context_pool_;
+		std::shared_ptr<ClientMetrics> metrics_;
+
+		std::mutex mtx_;							// serializes Connect()
+		connection_list_ptr connections_;			// std::atomic_load / atomic_store only
+		std::atomic<std::size_t> next_connection_{ 0 };
+	};
+}
+
+#endif // ! _SP_SOCKET_CLIENT_POOL_H_
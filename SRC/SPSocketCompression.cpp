@@ -0,0 +1,210 @@
+#include "SPSocketCompression.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(SPSOCKET_WITH_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace SPSocket
+{
+    std::uint32_t DictionaryId(const std::string& dictionary)
+    {
+        // FNV-1a, 0 is left for a server without compression.
+        std::uint32_t hash = 2166136261u;
+        for (unsigned char c : dictionary)
+            hash = (hash ^ c) * 16777619u;
+        return hash != 0 ? hash : 1;
+    }
+
+    std::string EncodeDictionaryId(const FrameCodec& codec, std::uint32_t id)
+    {
+        std::string frame(codec.HeaderWidth() + 4, '\0');
+        std::size_t width = codec.EncodeHeader(4, &frame[0], true);
+        for (std::size_t i = 0; i < 4; ++i)
+            frame[width + i] = static_cast<char>((id >> (24 - i * 8)) & 0xFF);
+        return frame;
+    }
+
+    bool DecodeDictionaryId(std::string_view payload, std::uint32_t& id)
+    {
+        if (payload.size() != 4)
+            return false;
+
+        id = 0;
+        for (unsigned char c : payload)
+            id = id << 8 | c;
+        return true;
+    }
+
+#if defined(SPSOCKET_WITH_ZLIB)
+
+    bool CompressionAvailable() { return true; }
+
+    // Raw deflate (negative window bits): no zlib header or checksum, the frame
+    // length already tells where a message ends.
+    struct FrameCompressor::stream {
+        z_stream z{};
+        bool ready = false;
+
+        explicit stream(int level)
+        {
+            ready = deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+        ~stream() { if (ready) deflateEnd(&z); }
+    };
+
+    struct FrameDecompressor::stream {
+        z_stream z{};
+        bool ready = false;
+
+        stream() { ready = inflateInit2(&z, -15) == Z_OK; }
+        ~stream() { if (ready) inflateEnd(&z); }
+    };
+
+    FrameCompressor::FrameCompressor(const FrameCodec& codec, const std::string& dictionary, int level)
+        : codec_(codec), dictionary_(dictionary), level_(std::min(std::max(level, 1), 9))
+    {
+        if (codec_.Mode() != FramingMode::F_LENGTH_PREFIX || codec_.HeaderWidth() != 4 || !codec_.CompressionFlag())
+            throw std::invalid_argument("compression needs a 4 byte length prefix with the compression flag");
+    }
+
+    FrameCompressor::~FrameCompressor() noexcept = default;
+
+    std::unique_ptr<FrameCompressor::stream> FrameCompressor::acquire() const
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (!idle_.empty())
+            {
+                std::unique_ptr<stream> s = std::move(idle_.back());
+                idle_.pop_back();
+                return s;
+            }
+        }
+        return std::unique_ptr<stream>(new stream(level_));
+    }
+
+    void FrameCompressor::release(std::unique_ptr<stream> s) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        idle_.push_back(std::move(s));
+    }
+
+    bool FrameCompressor::Compress(std::string_view frame, std::string& out) const
+    {
+        const std::size_t width = codec_.HeaderWidth();
+        if (frame.size() <= width)
+            return false;
+
+        std::unique_ptr<stream> s = acquire();
+        if (!s->ready)
+            return false;
+
+        // A reset forgets the dictionary, it has to be set again for every message.
+        z_stream& z = s->z;
+        deflateReset(&z);
+        if (!dictionary_.empty())
+            deflateSetDictionary(&z, reinterpret_cast<const Bytef*>(dictionary_.data()), static_cast<uInt>(dictionary_.size()));
+
+        std::string_view payload = frame.substr(width);
+        out.resize(width + deflateBound(&z, static_cast<uLong>(payload.size())));
+
+        z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+        z.avail_in = static_cast<uInt>(payload.size());
+        z.next_out = reinterpret_cast<Bytef*>(&out[width]);
+        z.avail_out = static_cast<uInt>(out.size() - width);
+
+        int result = deflate(&z, Z_FINISH);
+        std::size_t size = z.total_out;
+        release(std::move(s));
+
+        if (result != Z_STREAM_END || size >= payload.size())
+            return false;
+
+        codec_.EncodeHeader(size, &out[0], true);
+        out.resize(width + size);
+
+        frames.Add();
+        bytes_in.Add(frame.size());
+        bytes_out.Add(out.size());
+        return true;
+    }
+
+    FrameDecompressor::FrameDecompressor(const std::string& dictionary)
+        : dictionary_(dictionary), stream_(new stream())
+    {
+        if (!stream_->ready)
+            throw std::runtime_error("cannot initialize zlib");
+    }
+
+    FrameDecompressor::~FrameDecompressor() noexcept = default;
+
+    bool FrameDecompressor::Decompress(std::string_view payload, std::string& out, std::size_t max_size)
+    {
+        z_stream& z = stream_->z;
+        inflateReset(&z);
+        if (!dictionary_.empty() &&
+            inflateSetDictionary(&z, reinterpret_cast<const Bytef*>(dictionary_.data()), static_cast<uInt>(dictionary_.size())) != Z_OK)
+            return false;
+
+        z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+        z.avail_in = static_cast<uInt>(payload.size());
+
+        // Guess from the compressed size and double only when inflate runs out of
+        // room. Resizing zero-fills, so the capacity the largest message so far
+        // left behind is kept but not filled.
+        std::size_t capacity = std::min(std::max(payload.size() * 4, std::size_t(256)), max_size);
+        for (;;)
+        {
+            out.resize(capacity);
+            z.next_out = reinterpret_cast<Bytef*>(&out[z.total_out]);
+            z.avail_out = static_cast<uInt>(capacity - z.total_out);
+
+            int result = inflate(&z, Z_FINISH);
+            if (result == Z_STREAM_END)
+            {
+                out.resize(z.total_out);
+                return true;
+            }
+
+            // Anything but running out of room is a corrupt message.
+            if ((result != Z_BUF_ERROR && result != Z_OK) || z.avail_out != 0 || capacity >= max_size)
+                return false;
+
+            capacity = std::min(capacity * 2, max_size);
+        }
+    }
+
+#else
+
+    bool CompressionAvailable() { return false; }
+
+    struct FrameCompressor::stream {};
+    struct FrameDecompressor::stream {};
+
+    FrameCompressor::FrameCompressor(const FrameCodec& codec, const std::string&, int level)
+        : codec_(codec), level_(level)
+    {
+        throw std::runtime_error("built without SPSOCKET_WITH_ZLIB");
+    }
+
+    FrameCompressor::~FrameCompressor() noexcept = default;
+
+    std::unique_ptr<FrameCompressor::stream> FrameCompressor::acquire() const { return nullptr; }
+    void FrameCompressor::release(std::unique_ptr<stream>) const {}
+
+    bool FrameCompressor::Compress(std::string_view, std::string&) const { return false; }
+
+    FrameDecompressor::FrameDecompressor(const std::string&)
+    {
+        throw std::runtime_error("built without SPSOCKET_WITH_ZLIB");
+    }
+
+    FrameDecompressor::~FrameDecompressor() noexcept = default;
+
+    bool FrameDecompressor::Decompress(std::string_view, std::string&, std::size_t) { return false; }
+
+#endif
+}
@@ -0,0 +1,121 @@
+#ifndef _SP_SOCKET_COMPRESSION_H_
+#define _SP_SOCKET_COMPRESSION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SPSocketFraming.h"
+#include "SPSocketMetrics.h"
+
+namespace SPSocket
+{
+    // True if built with SPSOCKET_WITH_ZLIB (and linked against zlib). Without
+    // it the compressor and decompressor throw std::runtime_error on construction.
+    bool CompressionAvailable();
+
+    //
+    // Per-message compression of length-prefixed frames, deflate with a preset
+    // dictionary. Every message is compressed on its own, so any one of them can
+    // be decompressed without the others, e.g. by a client that joined late, and
+    // one compressed copy can be shared by all the sessions it goes out to. The
+    // dictionary, typically a few KB of representative payloads (instrument
+    // codes, field names, ...), primes the compressor with the strings short
+    // messages repeat, which they have too little room to do themselves. Both
+    // ends must use the same dictionary.
+    //
+    // A compressed frame is marked by the top bit of its 4 byte length header
+    // (see FrameCodec::UseCompressionFlag), so it can travel next to ordinary
+    // frames on the same connection:
+    //
+    //   +--------------------+----------------------------+
+    //   | 1 | 31 bit length  | deflate(payload, dict)     |
+    //   +--------------------+----------------------------+
+    //
+    // A message that would not get any smaller is left as it is.
+    //
+    class FrameCompressor {
+    public:
+
+        // codec must use a 4 byte length prefix with the compression flag, level
+        // is zlib's 1 (fastest) to 9 (smallest)
+        FrameCompressor(const FrameCodec& codec, const std::string& dictionary, int level = 6);
+        ~FrameCompressor() noexcept;
+
+        FrameCompressor(const FrameCompressor&) = delete;
+        FrameCompressor& operator=(const FrameCompressor&) = delete;
+
+        // Compresses an encoded frame into out, header included. Returns false,
+        // leaving out undefined, if the frame is a heartbeat or would not get
+        // smaller. Safe to call from any thread.
+        bool Compress(std::string_view frame, std::string& out) const;
+
+        // Messages compressed and their size before and after, frames included
+        mutable Counter frames;
+        mutable Counter bytes_in;
+        mutable Counter bytes_out;
+
+    private:
+
+        struct stream;
+
+        std::unique_ptr<stream> acquire() const;
+        void release(std::unique_ptr<stream> s) const;
+
+        FrameCodec codec_;
+        std::string dictionary_;
+        int level_;
+
+        // Idle deflate streams, one is taken per call so several threads can compress
+        mutable std::mutex mtx_;
+        mutable std::vector<std::unique_ptr<stream>> idle_;
+    };
+
+    //
+    // Compression is switched on per connection by a handshake, before the
+    // server compresses anything. Clients never send compressed messages, so a
+    // flagged frame from a client is always a request, and until the answer
+    // has arrived a flagged frame from the server is always the answer:
+    //
+    //   client -> server   flag | 4   dictionary id      compress for me
+    //   server -> client   flag | 0                      accepted
+    //   server -> client   flag | 4   dictionary id      refused, 0 = no compression
+    //
+    // A refused client keeps getting plain messages on the same connection.
+    //
+    // Identifies a dictionary in the handshake, never 0
+    std::uint32_t DictionaryId(const std::string& dictionary);
+
+    // A flagged frame carrying a dictionary id, and the id read back from its
+    // payload. False if the payload is no dictionary id.
+    std::string EncodeDictionaryId(const FrameCodec& codec, std::uint32_t id);
+    bool DecodeDictionaryId(std::string_view payload, std::uint32_t& id);
+
+    // The receiving side, for a single thread
+    class FrameDecompressor {
+    public:
+
+        explicit FrameDecompressor(const std::string& dictionary);
+        ~FrameDecompressor() noexcept;
+
+        FrameDecompressor(const FrameDecompressor&) = delete;
+        FrameDecompressor& operator=(const FrameDecompressor&) = delete;
+
+        // Decompresses the payload of a compressed frame into out, reusing its
+        // capacity. Returns false if it is corrupt or inflates beyond max_size.
+        bool Decompress(std::string_view payload, std::string& out, std::size_t max_size);
+
+    private:
+
+        struct stream;
+
+        std::string dictionary_;
+        std::unique_ptr<stream> stream_;
+    };
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "SPSocketCoroutine.h"
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+
+#include <boost/asio/compose.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+
+#include <stdexcept>
+
+namespace SPSocket
+{
+	// Takes the next frame from the FrameReader, reading until there is one.
+	struct CoSession::read_frame_op {
+		enum { starting, reading, ready } state;
+		CoSession* session;
+		std::string_view frame;
+		boost::system::error_code frame_error;
+
+		template <typename Self>
+		void operator()(Self& self, boost::system::error_code error = boost::system::error_code(), std::size_t n = 0)
+		{
+			if (state == ready)
+			{
+				self.complete(frame_error, frame);
+				return;
+			}
+			if (error)
+			{
+				self.complete(error, std::string_view());
+				return;
+			}
+			if (state == reading)
+				session->reader_.Commit(n);
+
+			// Whatever is buffered already comes first, only then read more.
+			for (;;)
+			{
+				const char* payload = nullptr;
+				std::size_t payload_size = 0;
+				FrameStatus status = session->reader_.Next(session->codec_, payload, payload_size);
+
+				if (status == FrameStatus::F_INCOMPLETE)
+					break;
+				if (status == FrameStatus::F_COMPLETE && payload_size == 0)
+					continue;
+
+				if (status == FrameStatus::F_COMPLETE)
+					frame = std::string_view(payload, payload_size);
+				else
+					frame_error = boost::asio::error::message_size;
+
+				// Never complete from within ReadFrame() itself.
+				if (state == starting)
+				{
+					state = ready;
+					boost::asio::post(session->socket_.get_executor(), std::move(self));
+					return;
+				}
+				self.complete(frame_error, frame);
+				return;
+			}
+
+			state = reading;
+			session->socket_.async_read_some(session->reader_.Prepare(), std::move(self));
+		}
+	};
+
+	awaitable<std::string_view> CoSession::ReadFrame()
+	{
+		return boost::asio::async_compose<const boost::asio::use_awaitable_t<>&, void(boost::system::error_code, std::string_view)>(
+			read_frame_op{ read_frame_op::starting, this, std::string_view(), boost::system::error_code() }, boost::asio::use_awaitable, socket_);
+	}
+
+	awaitable<std::size_t> CoSession::Write(std::string_view payload)
+	{
+		if (codec_.Mode() == FramingMode::F_DELIMITER)
+			return boost::asio::async_write(socket_, boost::asio::buffer(payload.data(), payload.size()), boost::asio::use_awaitable);
+
+		if (payload.size() > codec_.MaxFrameSize())
+			throw std::length_error("frame exceeds the maximum frame size");
+
+		std::size_t header_width = codec_.EncodeHeader(payload.size(), write_header_);
+		write_buffers_ = {
+			boost::asio::buffer(write_header_, header_width),
+			boost::asio::buffer(payload.data(), payload.size())
+		};
+		return boost::asio::async_write(socket_, write_buffers_, boost::asio::use_awaitable);
+	}
+
+	void CoSession::Close()
+	{
+		boost::system::error_code ignored_error;
+		socket_.shutdown(tcp::socket::shutdown_both, ignored_error);
+		socket_.close(ignored_error);
+	}
+
+	std::string CoSession::RemoteHost() const
+	{
+		boost::system::error_code error;
+		tcp::endpoint endpoint = socket_.remote_endpoint(error);
+		return error ? std::string() : endpoint.address().to_string();
+	}
+
+	unsigned short CoSession::RemotePort() const
+	{
+		boost::system::error_code error;
+		tcp::endpoint endpoint = socket_.remote_endpoint(error);
+		return error ? 0 : endpoint.port();
+	}
+
+	//----------------------------------------------------------------------
+
+	awaitable<void> SPSocketCoClient::Connect(const std::string& host, int port)
+	{
+		tcp::resolver resolver(socket_.get_executor());
+		auto endpoints = co_await resolver.async_resolve(host, std::to_string(port), boost::asio::use_awaitable);
+		co_await boost::asio::async_connect(socket_, endpoints, boost::asio::use_awaitable);
+		reader_.Clear();
+	}
+}
+
+#endif // BOOST_ASIO_HAS_CO_AWAIT
@@ -0,0 +1,121 @@
+#ifndef _SP_SOCKET_COROUTINE_H_
+#define _SP_SOCKET_COROUTINE_H_
+
+#include <boost/asio/detail/config.hpp>
+
+// Only when compiled as C++20 (or with the coroutines TS), the rest of the
+// library does not depend on it.
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+
+// Older Boost versions use std::exchange in awaitable.hpp without including it.
+#include <utility>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <array>
+#include <string>
+#include <string_view>
+
+#include "SPSocketFraming.h"
+
+namespace SPSocket
+{
+	using boost::asio::awaitable;
+	using boost::asio::ip::tcp;
+
+	//
+	// Awaitable framed messaging over a connected TCP socket, for request /
+	// response code written as a straight-line coroutine instead of a chain of
+	// On* callbacks:
+	//
+	//   awaitable<void> serve(CoSession session)
+	//   {
+	//       for (;;)
+	//       {
+	//           std::string_view request = co_await session.ReadFrame();
+	//           co_await session.Write(reply_to(request));
+	//       }
+	//   }
+	//
+	// Frames are decoded in place from a FrameReader, as in the callback API, so
+	// a view returned by ReadFrame() is only valid until the next ReadFrame().
+	// Heartbeats (empty frames) are skipped. Write() sends header and payload in
+	// one gathered async_write without copying the payload. At most one read and
+	// one write may be outstanding at a time.
+	//
+	// Errors are thrown as boost::system::system_error, the way use_awaitable
+	// reports them, e.g. boost::asio::error::eof when the peer closes.
+	//
+	// Coroutine frames come from Asio's per-thread recycling allocator (leave
+	// BOOST_ASIO_DISABLE_AWAITABLE_FRAME_RECYCLING undefined), as does the state
+	// of each read and write. It keeps one frame per thread, so ReadFrame() and
+	// Write() are plain composed operations rather than coroutines of their own:
+	// a coroutine awaiting them needs no second frame and a steady request /
+	// response loop reuses the same memory every turn. The coecho scenario of
+	// SampleBenchmark fails if a warmed up echo session allocates at all.
+	//
+	class CoSession {
+	public:
+
+		explicit CoSession(tcp::socket socket, const FrameCodec& codec = FrameCodec())
+			: socket_(std::move(socket)), codec_(codec)
+		{ };
+
+		CoSession(CoSession&&) = default;
+
+		// Framing, must match the peer's
+		void UseReadUntil(char terminator = '\n') { codec_.UseDelimiter(terminator); }
+		void UseLengthPrefix(std::size_t header_width = 4, ByteOrder order = ByteOrder::B_BIG_ENDIAN) { codec_.UseLengthPrefix(header_width, order); }
+
+		// The next message, without header or terminator
+		awaitable<std::string_view> ReadFrame();
+
+		// Sends one message, adding the length header in length-prefix mode. In
+		// delimiter mode the payload is sent as is and must already be terminated.
+		// The payload must stay valid until the write completes. Returns the bytes
+		// written, header included.
+		awaitable<std::size_t> Write(std::string_view payload);
+
+		void Close();
+		bool IsOpen() const { return socket_.is_open(); }
+
+		tcp::socket& Socket() { return socket_; }
+		std::string RemoteHost() const;
+		unsigned short RemotePort() const;
+
+	protected:
+
+		struct read_frame_op;
+
+		tcp::socket socket_;
+		FrameCodec codec_;
+		FrameReader reader_;
+
+		char write_header_[4] = {};
+		std::array<boost::asio::const_buffer, 2> write_buffers_;
+	};
+
+	//
+	// The client side of a CoSession: co_await client.Connect(host, port), then
+	// ReadFrame() / Write() as above.
+	//
+	class SPSocketCoClient : public CoSession {
+	public:
+
+		explicit SPSocketCoClient(boost::asio::io_context& io_context)
+			: CoSession(tcp::socket(io_context))
+		{ };
+
+		// Resolves the host and tries each of its addresses in turn
+		awaitable<void> Connect(const std::string& host, int port);
+	};
+}
+
+#endif // BOOST_ASIO_HAS_CO_AWAIT
+
+#endif // ! _SP_SOCKET_COROUTINE_H_
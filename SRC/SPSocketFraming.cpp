@@ -0,0 +1,273 @@
+#include "SPSocketFraming.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#define SP_SOCKET_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SP_SOCKET_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace SPSocket
+{
+#if defined(SP_SOCKET_AVX2) || defined(SP_SOCKET_SSE2)
+    static inline unsigned int lowest_bit(unsigned int mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+#endif
+
+    void EncodeSequence(std::uint64_t seq, char* header)
+    {
+        for (std::size_t i = 0; i < SEQUENCE_HEADER_SIZE; ++i)
+            header[i] = static_cast<char>((seq >> ((SEQUENCE_HEADER_SIZE - 1 - i) * 8)) & 0xFF);
+    }
+
+    std::uint64_t DecodeSequence(const char* header)
+    {
+        std::uint64_t seq = 0;
+        for (std::size_t i = 0; i < SEQUENCE_HEADER_SIZE; ++i)
+            seq = (seq << 8) | static_cast<unsigned char>(header[i]);
+        return seq;
+    }
+
+    const char* FindDelimiter(const char* data, std::size_t size, char delimiter)
+    {
+#if defined(SP_SOCKET_AVX2)
+        const __m256i pattern32 = _mm256_set1_epi8(delimiter);
+        while (size >= 32)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern32)));
+            if (mask)
+                return data + lowest_bit(mask);
+            data += 32;
+            size -= 32;
+        }
+#endif
+
+#if defined(SP_SOCKET_SSE2)
+        const __m128i pattern16 = _mm_set1_epi8(delimiter);
+        while (size >= 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern16)));
+            if (mask)
+                return data + lowest_bit(mask);
+            data += 16;
+            size -= 16;
+        }
+#endif
+
+        // The tail, or everything when there is no SIMD support.
+        return size > 0 ? static_cast<const char*>(std::memchr(data, delimiter, size)) : nullptr;
+    }
+
+    void FrameCodec::UseDelimiter(char term)
+    {
+        mode = FramingMode::F_DELIMITER;
+        terminator = term;
+        compression_flag = false;
+    }
+
+    void FrameCodec::UseLengthPrefix(std::size_t width, ByteOrder order)
+    {
+        if (width != 2 && width != 4)
+            throw std::invalid_argument("length prefix width must be 2 or 4");
+
+        mode = FramingMode::F_LENGTH_PREFIX;
+        header_width = width;
+        byte_order = order;
+
+        // A u16 header cannot describe anything bigger anyway.
+        if (header_width == 2)
+            max_frame_size = std::min<std::size_t>(max_frame_size, 0xFFFF);
+        if (header_width != 4)
+            compression_flag = false;
+    }
+
+    void FrameCodec::UseCompressionFlag(bool enable)
+    {
+        if (enable && (mode != FramingMode::F_LENGTH_PREFIX || header_width != 4))
+            throw std::invalid_argument("the compression flag needs a 4 byte length prefix");
+
+        compression_flag = enable;
+    }
+
+    // The flag is the top bit of the length, i.e. of the most significant byte.
+    static constexpr std::size_t COMPRESSED_FLAG = std::size_t(1) << 31;
+
+    bool FrameCodec::IsCompressed(const char* payload) const
+    {
+        if (!compression_flag)
+            return false;
+
+        const char* msb = byte_order == ByteOrder::B_BIG_ENDIAN ? payload - header_width : payload - 1;
+        return (static_cast<unsigned char>(*msb) & 0x80) != 0;
+    }
+
+    FrameStatus FrameCodec::Decode(const char* data, std::size_t size,
+        const char*& payload, std::size_t& payload_size, std::size_t& consumed,
+        std::size_t scanned) const
+    {
+        if (mode == FramingMode::F_DELIMITER)
+        {
+            scanned = std::min(scanned, size);
+            const char* end = FindDelimiter(data + scanned, size - scanned, terminator);
+            if (!end)
+                return size > max_frame_size ? FrameStatus::F_OVERSIZED : FrameStatus::F_INCOMPLETE;
+
+            payload = data;
+            payload_size = end - data;
+            consumed = payload_size + 1;
+            return FrameStatus::F_COMPLETE;
+        }
+
+        if (size < header_width)
+            return FrameStatus::F_INCOMPLETE;
+
+        const unsigned char* h = reinterpret_cast<const unsigned char*>(data);
+        std::size_t length = 0;
+        for (std::size_t i = 0; i < header_width; ++i)
+        {
+            std::size_t shift = byte_order == ByteOrder::B_BIG_ENDIAN ? (header_width - 1 - i) * 8 : i * 8;
+            length |= std::size_t(h[i]) << shift;
+        }
+
+        if (compression_flag)
+            length &= ~COMPRESSED_FLAG;
+
+        if (length > max_frame_size)
+            return FrameStatus::F_OVERSIZED;
+
+        if (size < header_width + length)
+            return FrameStatus::F_INCOMPLETE;
+
+        payload = data + header_width;
+        payload_size = length;
+        consumed = header_width + length;
+        return FrameStatus::F_COMPLETE;
+    }
+
+    std::size_t FrameCodec::EncodeHeader(std::size_t payload_size, char* header, bool compressed) const
+    {
+        if (compressed)
+            payload_size |= COMPRESSED_FLAG;
+
+        for (std::size_t i = 0; i < header_width; ++i)
+        {
+            std::size_t shift = byte_order == ByteOrder::B_BIG_ENDIAN ? (header_width - 1 - i) * 8 : i * 8;
+            header[i] = static_cast<char>((payload_size >> shift) & 0xFF);
+        }
+        return header_width;
+    }
+
+    std::string FrameCodec::Encode(const std::string& payload) const
+    {
+        if (mode == FramingMode::F_DELIMITER)
+            return payload;
+
+        if (payload.size() > max_frame_size)
+            throw std::length_error("frame exceeds the maximum frame size");
+
+        std::string frame(header_width + payload.size(), '\0');
+        EncodeHeader(payload.size(), &frame[0]);
+        std::memcpy(&frame[header_width], payload.data(), payload.size());
+        return frame;
+    }
+
+    //----------------------------------------------------------------------
+
+    boost::asio::mutable_buffer FrameReader::Prepare(std::size_t min_size)
+    {
+        if (buffer_.size() - end_ < min_size)
+        {
+            // Move the partial frame to the front, then grow if that is still not enough.
+            if (begin_ > 0)
+            {
+                std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+                end_ -= begin_;
+                begin_ = 0;
+            }
+            if (buffer_.size() - end_ < min_size)
+                buffer_.resize(std::max(buffer_.size() * 2, end_ + min_size));
+        }
+        return boost::asio::buffer(buffer_.data() + end_, buffer_.size() - end_);
+    }
+
+    FrameStatus FrameReader::Next(const FrameCodec& codec, const char*& payload, std::size_t& payload_size)
+    {
+        std::size_t consumed = 0;
+        FrameStatus status = codec.Decode(buffer_.data() + begin_, end_ - begin_,
+            payload, payload_size, consumed, scanned_);
+
+        if (status == FrameStatus::F_COMPLETE)
+        {
+            begin_ += consumed;
+            scanned_ = 0;
+            if (begin_ == end_)
+                begin_ = end_ = 0;
+        }
+        else
+        {
+            // Do not search the same bytes again when more data arrives.
+            scanned_ = end_ - begin_;
+        }
+        return status;
+    }
+
+    FrameStatus FrameReader::NextBatch(const FrameCodec& codec, std::vector<std::string_view>& frames)
+    {
+        // Walk the buffer once, the read position is only committed at the end.
+        const char* data = buffer_.data() + begin_;
+        std::size_t size = end_ - begin_;
+        std::size_t offset = 0;
+        std::size_t scanned = scanned_;
+
+        FrameStatus status;
+        for (;;)
+        {
+            const char* payload = nullptr;
+            std::size_t payload_size = 0;
+            std::size_t consumed = 0;
+
+            status = codec.Decode(data + offset, size - offset, payload, payload_size, consumed, scanned);
+            if (status != FrameStatus::F_COMPLETE)
+                break;
+
+            frames.emplace_back(payload, payload_size);
+            offset += consumed;
+            scanned = 0;
+        }
+
+        begin_ += offset;
+        scanned_ = status == FrameStatus::F_INCOMPLETE ? end_ - begin_ : 0;
+        if (begin_ == end_)
+            begin_ = end_ = scanned_ = 0;
+
+        return status;
+    }
+
+    std::string_view FrameReader::TakeAll()
+    {
+        std::string_view data(buffer_.data() + begin_, end_ - begin_);
+        begin_ = end_ = scanned_ = 0;
+        return data;
+    }
+}
@@ -0,0 +1,156 @@
+#ifndef _SP_SOCKET_FRAMING_H_
+#define _SP_SOCKET_FRAMING_H_
+
+#include <boost/asio/buffer.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace SPSocket
+{
+    enum class FramingMode
+    {
+        F_DELIMITER,        // frames end with a terminator char, e.g. '\n'
+        F_LENGTH_PREFIX     // frames start with a fixed width binary length header
+    };
+
+    enum class ByteOrder
+    {
+        B_BIG_ENDIAN,
+        B_LITTLE_ENDIAN
+    };
+
+    enum class FrameStatus
+    {
+        F_INCOMPLETE,       // need more bytes
+        F_COMPLETE,         // a frame was extracted
+        F_OVERSIZED         // declared frame length exceeds the configured maximum
+    };
+
+    // Datagrams of the UDP feed may start with the sequence number of their message,
+    // 8 bytes big endian, counting up by one per message, so receivers can detect loss.
+    constexpr std::size_t SEQUENCE_HEADER_SIZE = 8;
+
+    void EncodeSequence(std::uint64_t seq, char* header);
+    std::uint64_t DecodeSequence(const char* header);
+
+    // Returns a pointer to the first occurrence of delimiter in data, or nullptr.
+    // Compares 32 (AVX2) or 16 (SSE2) bytes per step when the target supports it,
+    // falls back to memchr otherwise.
+    const char* FindDelimiter(const char* data, std::size_t size, char delimiter);
+
+    //
+    // Describes how a byte stream is cut into messages and how outgoing messages
+    // are wrapped. In length-prefix mode every frame starts with a 2 or 4 byte
+    // unsigned length (of the payload only) in the configured byte order, so a
+    // frame can be extracted by reading the header alone, without scanning the
+    // payload, and the payload may contain any bytes. A zero length frame is a
+    // heartbeat, the same way an empty line is in delimiter mode.
+    //
+    // With the compression flag the top bit of a 4 byte length marks a frame
+    // whose payload is compressed (see FrameCompressor), or one of the frames of
+    // the handshake that switches compression on.
+    //
+    class FrameCodec {
+    public:
+
+        void UseDelimiter(char terminator = '\n');
+        void UseLengthPrefix(std::size_t header_width = 4, ByteOrder order = ByteOrder::B_BIG_ENDIAN);
+
+        // Frames longer than this are treated as a protocol error
+        void UseMaxFrameSize(std::size_t max_size) { max_frame_size = max_size; }
+
+        // Reserves the top bit of the length for the compressed flag, only with a
+        // 4 byte length prefix. Call after UseLengthPrefix().
+        void UseCompressionFlag(bool enable = true);
+
+        FramingMode Mode() const { return mode; }
+        char Terminator() const { return terminator; }
+        std::size_t HeaderWidth() const { return header_width; }
+        std::size_t MaxFrameSize() const { return max_frame_size; }
+        bool CompressionFlag() const { return compression_flag; }
+
+        // Whether a payload returned by Decode() had the compressed flag set. The
+        // header is read from right in front of the payload.
+        bool IsCompressed(const char* payload) const;
+
+        // Tries to extract one frame from the front of data. On F_COMPLETE, payload
+        // points into data and consumed holds the number of bytes to discard,
+        // header or terminator included. In delimiter mode the first `scanned`
+        // bytes are known not to contain the terminator and are skipped.
+        FrameStatus Decode(const char* data, std::size_t size,
+            const char*& payload, std::size_t& payload_size, std::size_t& consumed,
+            std::size_t scanned = 0) const;
+
+        // Writes the length header for a payload of the given size, returns its width
+        std::size_t EncodeHeader(std::size_t payload_size, char* header, bool compressed = false) const;
+
+        // Wraps a payload for sending. In delimiter mode the payload is sent as is,
+        // the caller is expected to have terminated it already.
+        std::string Encode(const std::string& payload) const;
+
+    private:
+
+        FramingMode mode = FramingMode::F_DELIMITER;
+        ByteOrder byte_order = ByteOrder::B_BIG_ENDIAN;
+        char terminator = '\n';
+        std::size_t header_width = 4;
+        std::size_t max_frame_size = 16 * 1024 * 1024;
+        bool compression_flag = false;
+    };
+
+    //
+    // A fixed-capacity receive buffer that frames are decoded from in place.
+    //
+    //   0          begin_               end_                 capacity
+    //   +-----------+--------------------+--------------------+
+    //   | consumed  | unconsumed bytes   | free, read into    |
+    //   +-----------+--------------------+--------------------+
+    //
+    // Reads go into the free space at the back via Prepare()/Commit(), complete
+    // frames are taken from the front with Next() as pointers into the buffer.
+    // Like a ring buffer the consumed space is reused, but instead of wrapping
+    // around (which would split frames at the end) the trailing partial frame is
+    // moved to the front once the free space runs out. That is at most one frame
+    // per buffer refill, instead of the whole remainder per message. The buffer
+    // only grows when a single frame does not fit, so a steady stream of frames
+    // is received without any allocation.
+    //
+    class FrameReader {
+    public:
+
+        explicit FrameReader(std::size_t capacity = 8 * 1024) : buffer_(capacity) {}
+
+        // Space to read into, grows the buffer if a single frame needs more room
+        boost::asio::mutable_buffer Prepare(std::size_t min_size = 1024);
+
+        // Marks n bytes of the prepared space as received
+        void Commit(std::size_t n) { end_ += n; }
+
+        // Extracts the next complete frame, the payload stays valid until the next Prepare()
+        FrameStatus Next(const FrameCodec& codec, const char*& payload, std::size_t& payload_size);
+
+        // Extracts every complete frame currently buffered in one pass, appending
+        // them to frames. Returns F_INCOMPLETE once only a partial frame (or
+        // nothing) is left, or F_OVERSIZED on a protocol error.
+        FrameStatus NextBatch(const FrameCodec& codec, std::vector<std::string_view>& frames);
+
+        // Takes everything received as is, for unframed reading
+        std::string_view TakeAll();
+
+        std::size_t Size() const { return end_ - begin_; }
+        void Clear() { begin_ = end_ = scanned_ = 0; }
+
+    private:
+
+        std::vector<char> buffer_;
+        std::size_t begin_ = 0;
+        std::size_t end_ = 0;
+        std::size_t scanned_ = 0;       // bytes of the partial frame already searched for a terminator
+    };
+}
+
+#endif
@@ -0,0 +1,117 @@
+// Copyright (c) 2003-2021 Christopher M. Kohlhoff (chris at kohlhoff dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Heavy modification by Tim Hsu, Sharp Point Ltd. 2022.
+
+#include "SPSocketIOContextPool.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <stdexcept>
+
+namespace SPSocket
+{
+    IOContextPool::IOContextPool(std::size_t pool_size, bool pin_threads)
+        : pin_threads_(pin_threads)
+    {
+        if (pool_size == 0)
+            throw std::runtime_error("IOContextPool size is 0");
+
+        // Give all the io_contexts work to do so that their run() functions will
+        // not exit until they are explicitly stopped. The concurrency hint of 1
+        // tells Asio only one thread runs each one, which saves some wake-ups of
+        // other threads. The scheduler is still locked, other threads post into
+        // these io_contexts, so the UNSAFE hints that drop the locking cannot be used.
+        for (std::size_t i = 0; i < pool_size; ++i)
+        {
+            io_context_ptr io_context(new boost::asio::io_context(1));
+            io_contexts_.push_back(io_context);
+            work_.push_back(boost::asio::make_work_guard(*io_context));
+        }
+    }
+
+    IOContextPool::~IOContextPool() noexcept
+    {
+        Stop();
+    }
+
+    void IOContextPool::Run()
+    {
+        if (!threads_.empty())
+            return;
+
+        for (std::size_t i = 0; i < io_contexts_.size(); ++i)
+        {
+            io_context_ptr io_context = io_contexts_[i];
+            threads_.emplace_back([io_context]() { io_context->run(); });
+
+            if (pin_threads_)
+                pin_thread(threads_.back(), i);
+        }
+    }
+
+    void IOContextPool::Stop()
+    {
+        for (auto& io_context : io_contexts_)
+            io_context->stop();
+
+        // Called from a handler of the pool, its own thread cannot be joined. It
+        // returns from run() once the handler is done, with the io_context it holds.
+        bool inside = false;
+        for (std::size_t i = 0; i < threads_.size(); ++i)
+        {
+            if (io_contexts_[i]->get_executor().running_in_this_thread())
+            {
+                threads_[i].detach();
+                inside = true;
+            }
+            else if (threads_[i].joinable())
+            {
+                threads_[i].join();
+            }
+        }
+        threads_.clear();
+
+        // Allow the pool to be run again after being stopped, unless one of its
+        // run() calls has yet to return.
+        if (!inside)
+        {
+            for (auto& io_context : io_contexts_)
+                io_context->restart();
+        }
+    }
+
+    boost::asio::io_context& IOContextPool::GetIOContext()
+    {
+        std::size_t index = next_io_context_.fetch_add(1, std::memory_order_relaxed);
+        return *io_contexts_[index % io_contexts_.size()];
+    }
+
+    void IOContextPool::pin_thread(std::thread& thread, std::size_t index)
+    {
+        unsigned int cores = std::thread::hardware_concurrency();
+        if (cores == 0)
+            return;
+
+        std::size_t core = index % cores;
+
+#if defined(_WIN32)
+        SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(core, &cpuset);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+#else
+        (void)thread;
+        (void)core;
+#endif
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef _SP_SOCKET_IO_CONTEXT_POOL_H_
+#define _SP_SOCKET_IO_CONTEXT_POOL_H_
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// https://www.boost.org/doc/libs/1_78_0/doc/html/boost_asio/example/cpp03/http/server2/io_context_pool.hpp
+
+namespace SPSocket
+{
+    //
+    // A pool of io_context objects, each run by exactly one thread. Since every
+    // io_context only ever has a single thread calling run(), all handlers of an
+    // object bound to one of these io_contexts execute sequentially, giving each
+    // TCP_Session an implicit strand without any extra locking.
+    //
+    // Threads are optionally pinned to a core each (thread i -> core i modulo the
+    // number of cores) so that a session's data stays in the same cache.
+    //
+    class IOContextPool {
+    public:
+
+        explicit IOContextPool(std::size_t pool_size, bool pin_threads = true);
+
+        ~IOContextPool() noexcept;
+
+        IOContextPool(const IOContextPool&) = delete;
+        IOContextPool& operator=(const IOContextPool&) = delete;
+
+        // Starts one thread per io_context, does nothing if already running
+        void Run();
+
+        // Stops all io_contexts and joins the threads, except the calling one if it
+        // is a thread of the pool
+        void Stop();
+
+        // Gets the next io_context to use, in round-robin order
+        boost::asio::io_context& GetIOContext();
+
+        // Number of io_contexts in the pool
+        std::size_t Size() const { return io_contexts_.size(); }
+
+    private:
+
+        void pin_thread(std::thread& thread, std::size_t index);
+
+        typedef std::shared_ptr<boost::asio::io_context> io_context_ptr;
+        typedef boost::asio::executor_work_guard<boost::asio::io_context::executor_type> io_context_work;
+
+        bool pin_threads_;
+
+        std::vector<io_context_ptr> io_contexts_;
+        std::list<io_context_work> work_;
+        std::vector<std::thread> threads_;
+
+        std::atomic<std::size_t> next_io_context_{ 0 };
+    };
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef _SP_SOCKET_MPSC_QUEUE_H_
+#define _SP_SOCKET_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace SPSocket
+{
+    //
+    // Unbounded lock-free multi-producer / single-consumer queue.
+    //
+    // Producers push onto an intrusive singly linked stack with a single CAS. The
+    // consumer takes the whole stack at once with an atomic exchange and reverses
+    // it, so it always drains in batches and FIFO order per producer is kept.
+    // Since the consumer only ever swaps the head with null there is no ABA
+    // problem and no node is ever touched by more than one side at a time.
+    //
+    // Push() reports whether the queue was empty beforehand. Exactly one producer
+    // observes each empty -> non-empty transition, which makes it the one and only
+    // producer responsible for waking the consumer (e.g. by posting a drain to
+    // the io_context). Every other producer just pushes and returns.
+    //
+    // Nodes are not allocated per element. They come from chunks owned by the
+    // queue, each twice the size of the one before, and the consumer puts them
+    // on a free list once drained, so a queue that has seen its peak depth once
+    // pushes without touching the heap:
+    //
+    //   chunks:  [ 16 ][ 16 ][   32   ][       64       ] ...
+    //   free:    head (tag | index) -> 5 -> 17 -> 2 -> ...
+    //
+    // Producers pop the free list concurrently. Its head carries a counter next
+    // to the node index, bumped by every change, so a CAS cannot succeed on a
+    // head that was popped and pushed back in the meantime. Nodes are only freed
+    // with the queue, which holds on to its peak depth.
+    //
+    template <typename T>
+    class MPSCQueue {
+    public:
+
+        MPSCQueue() = default;
+
+        ~MPSCQueue() noexcept
+        {
+            Consume([](T&&) {});
+        }
+
+        MPSCQueue(const MPSCQueue&) = delete;
+        MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+        // Safe to call from any thread, returns true if the queue was empty
+        bool Push(T value)
+        {
+            node* n = acquire();
+            n->value = std::move(value);
+
+            node* head = head_.load(std::memory_order_relaxed);
+            do
+            {
+                n->next = head;
+            } while (!head_.compare_exchange_weak(head, n,
+                std::memory_order_release, std::memory_order_relaxed));
+
+            return head == nullptr;
+        }
+
+        // Consumer only, hands every element pushed so far to f in FIFO order and
+        // returns how many there were
+        template <typename F>
+        std::size_t Consume(F&& f)
+        {
+            node* list = head_.exchange(nullptr, std::memory_order_acquire);
+            if (!list)
+                return 0;
+
+            // The stack is newest first, reverse it to get arrival order. The
+            // newest node ends up last, which is where the free list is spliced on.
+            node* last = list;
+            node* fifo = nullptr;
+            while (list)
+            {
+                node* next = list->next;
+                list->next = fifo;
+                fifo = list;
+                list = next;
+            }
+
+            // The element leaves its node before f sees it, so whatever f does not
+            // take is released now rather than when the node is reused.
+            std::size_t count = 0;
+            for (node* n = fifo; n; n = n->next)
+            {
+                T value(std::move(n->value));
+                f(std::move(value));
+                n->next_free.store(n->next ? n->next->index : nil, std::memory_order_relaxed);
+                ++count;
+            }
+
+            release(fifo, last);
+            return count;
+        }
+
+        // Snapshot only, may be stale by the time it returns
+        bool Empty() const { return head_.load(std::memory_order_relaxed) == nullptr; }
+
+    private:
+
+        struct node {
+            T value{};
+            node* next = nullptr;
+            std::atomic<std::uint32_t> next_free{ 0 };
+            std::uint32_t index = 0;
+        };
+
+        static constexpr std::uint32_t nil = 0xffffffff;
+        static constexpr std::uint32_t first_chunk = 16;
+        static constexpr std::size_t max_chunks = 27;       // 2^30 nodes, the consumer has long gone by then
+
+        static std::uint32_t index_of(std::uint64_t head) { return static_cast<std::uint32_t>(head); }
+
+        static std::uint64_t make_head(std::uint64_t previous, std::uint32_t index)
+        {
+            return ((previous >> 32) + 1) << 32 | index;
+        }
+
+        // Chunk 0 and 1 hold first_chunk nodes, chunk k > 0 starts at first_chunk << (k - 1)
+        node* at(std::uint32_t index) const
+        {
+            std::size_t k = 0;
+            for (std::uint32_t q = index / first_chunk; q > 0; q >>= 1)
+                ++k;
+            return &chunks_[k][k == 0 ? index : index - (first_chunk << (k - 1))];
+        }
+
+        node* acquire()
+        {
+            std::uint64_t head = free_.load(std::memory_order_acquire);
+            for (;;)
+            {
+                std::uint32_t index = index_of(head);
+                if (index == nil)
+                {
+                    grow();
+                    head = free_.load(std::memory_order_acquire);
+                    continue;
+                }
+
+                // The node may be taken by another producer meanwhile, then the
+                // link read here is stale and the CAS fails on the bumped tag.
+                node* n = at(index);
+                std::uint32_t next = n->next_free.load(std::memory_order_relaxed);
+                if (free_.compare_exchange_weak(head, make_head(head, next),
+                    std::memory_order_acquire, std::memory_order_acquire))
+                    return n;
+            }
+        }
+
+        // Pushes the chain first..last, already linked through next_free
+        void release(node* first, node* last)
+        {
+            std::uint64_t head = free_.load(std::memory_order_relaxed);
+            do
+            {
+                last->next_free.store(index_of(head), std::memory_order_relaxed);
+            } while (!free_.compare_exchange_weak(head, make_head(head, first->index),
+                std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        // Only a producer finding the free list empty gets here, the others wait for
+        // it on the mutex and find the new chunk
+        void grow()
+        {
+            std::lock_guard<std::mutex> lock(grow_mtx_);
+            if (index_of(free_.load(std::memory_order_acquire)) != nil || chunk_count_ == max_chunks)
+                return;
+
+            const std::uint32_t base = chunk_count_ == 0 ? 0 : first_chunk << (chunk_count_ - 1);
+            const std::uint32_t size = first_chunk << (chunk_count_ == 0 ? 0 : chunk_count_ - 1);
+            chunks_[chunk_count_].reset(new node[size]);
+            node* chunk = chunks_[chunk_count_++].get();
+
+            for (std::uint32_t i = 0; i < size; ++i)
+            {
+                chunk[i].index = base + i;
+                chunk[i].next_free.store(i + 1 < size ? base + i + 1 : nil, std::memory_order_relaxed);
+            }
+            release(&chunk[0], &chunk[size - 1]);
+        }
+
+        std::atomic<node*> head_{ nullptr };
+        std::atomic<std::uint64_t> free_{ nil };
+
+        std::mutex grow_mtx_;
+        std::size_t chunk_count_ = 0;
+        std::unique_ptr<node[]> chunks_[max_chunks];
+    };
+}
+
+#endif
@@ -0,0 +1,331 @@
+#include "SPSocketMetrics.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace SPSocket
+{
+    static std::size_t this_thread_shard()
+    {
+        // Threads are spread over the shards in order of their first use.
+        static std::atomic<std::size_t> next_shard{ 0 };
+        thread_local std::size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % Counter::shard_count;
+        return shard;
+    }
+
+    void Counter::Add(std::uint64_t n)
+    {
+        shards_[this_thread_shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    std::uint64_t Counter::Load() const
+    {
+        std::uint64_t total = 0;
+        for (const auto& s : shards_)
+            total += s.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    //----------------------------------------------------------------------
+
+    static inline std::size_t highest_bit(std::uint64_t value)
+    {
+        std::size_t bit = 0;
+        while (value >>= 1)
+            ++bit;
+        return bit;
+    }
+
+    std::size_t Histogram::BucketIndex(std::uint64_t value)
+    {
+        // Values below sub_bucket_count get a bucket each, above that every power
+        // of two is split into sub_bucket_count buckets by its next highest bits.
+        if (value < sub_bucket_count)
+            return static_cast<std::size_t>(value);
+
+        std::size_t exponent = highest_bit(value);
+        std::size_t sub = static_cast<std::size_t>(value >> (exponent - sub_bucket_bits)) & (sub_bucket_count - 1);
+        return sub_bucket_count + (exponent - sub_bucket_bits) * sub_bucket_count + sub;
+    }
+
+    std::uint64_t Histogram::BucketUpperBound(std::size_t index)
+    {
+        if (index < sub_bucket_count)
+            return index;
+
+        std::size_t exponent = (index - sub_bucket_count) / sub_bucket_count + sub_bucket_bits;
+        std::uint64_t sub = (index - sub_bucket_count) % sub_bucket_count;
+        std::uint64_t lower = (sub_bucket_count + sub) << (exponent - sub_bucket_bits);
+        std::uint64_t width = std::uint64_t(1) << (exponent - sub_bucket_bits);
+        return lower + (width - 1);
+    }
+
+    Histogram::Histogram(std::size_t shards)
+        : shard_count_(shards > 0 ? shards : 1),
+        shards_(new shard[shard_count_])
+    {
+    }
+
+    void Histogram::Record(std::uint64_t value)
+    {
+        // The count is the sum of the buckets, see Snapshot(). More threads than
+        // shards may still share one, hence the compare-exchange for the maximum.
+        shard& s = shards_[shard_count_ > 1 ? this_thread_shard() % shard_count_ : 0];
+        s.buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(value, std::memory_order_relaxed);
+
+        std::uint64_t max = s.max.load(std::memory_order_relaxed);
+        while (value > max && !s.max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+            ;
+    }
+
+    HistogramSnapshot Histogram::Snapshot() const
+    {
+        HistogramSnapshot snapshot;
+        snapshot.buckets.resize(bucket_count);
+
+        // Recording is not stopped meanwhile, so take the count from the buckets
+        // themselves to keep the percentiles consistent.
+        for (std::size_t k = 0; k < shard_count_; ++k)
+        {
+            const shard& s = shards_[k];
+            for (std::size_t i = 0; i < bucket_count; ++i)
+            {
+                std::uint64_t n = s.buckets[i].load(std::memory_order_relaxed);
+                snapshot.buckets[i] += n;
+                snapshot.count += n;
+            }
+            snapshot.sum += s.sum.load(std::memory_order_relaxed);
+            snapshot.max = std::max(snapshot.max, s.max.load(std::memory_order_relaxed));
+        }
+        return snapshot;
+    }
+
+    std::uint64_t HistogramSnapshot::Percentile(double q) const
+    {
+        if (count == 0)
+            return 0;
+
+        q = std::min(std::max(q, 0.0), 1.0);
+        std::uint64_t rank = static_cast<std::uint64_t>(q * double(count) + 0.5);
+        if (rank < 1)
+            rank = 1;
+
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < buckets.size(); ++i)
+        {
+            seen += buckets[i];
+            if (seen >= rank)
+                return std::min(Histogram::BucketUpperBound(i), max);
+        }
+        return max;
+    }
+
+    //----------------------------------------------------------------------
+
+    static double seconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    ServerMetricsSnapshot ServerMetrics::Snapshot() const
+    {
+        ServerMetricsSnapshot snapshot;
+        snapshot.uptime_sec = seconds_since(start_);
+        snapshot.accepts = accepts.Load();
+        snapshot.accept_errors = accept_errors.Load();
+        snapshot.disconnects = disconnects.Load();
+        snapshot.timeouts = timeouts.Load();
+        snapshot.reads = reads.Load();
+        snapshot.writes = writes.Load();
+        snapshot.bytes_in = bytes_in.Load();
+        snapshot.bytes_out = bytes_out.Load();
+        snapshot.msgs_in = msgs_in.Load();
+        snapshot.msgs_out = msgs_out.Load();
+        snapshot.heartbeats = heartbeats.Load();
+        snapshot.overflow_disconnects = overflow_disconnects.Load();
+        snapshot.dropped = dropped.Load();
+        snapshot.conflated = conflated.Load();
+        snapshot.compressed_sessions = compressed_sessions.Load();
+        snapshot.compression_refused = compression_refused.Load();
+        snapshot.frames_per_read = frames_per_read.Snapshot();
+        snapshot.write_time = write_time.Snapshot();
+        snapshot.deliver_to_wire = deliver_to_wire.Snapshot();
+        return snapshot;
+    }
+
+    ClientMetricsSnapshot ClientMetrics::Snapshot() const
+    {
+        ClientMetricsSnapshot snapshot;
+        snapshot.uptime_sec = seconds_since(start_);
+        snapshot.connects = connects.Load();
+        snapshot.disconnects = disconnects.Load();
+        snapshot.timeouts = timeouts.Load();
+        snapshot.reads = reads.Load();
+        snapshot.writes = writes.Load();
+        snapshot.bytes_in = bytes_in.Load();
+        snapshot.bytes_out = bytes_out.Load();
+        snapshot.msgs_in = msgs_in.Load();
+        snapshot.msgs_out = msgs_out.Load();
+        snapshot.high_water_marks = high_water_marks.Load();
+        snapshot.recv_stalls = recv_stalls.Load();
+        snapshot.reconnects = reconnects.Load();
+        snapshot.decompressed = decompressed.Load();
+        snapshot.frames_per_read = frames_per_read.Snapshot();
+        snapshot.write_time = write_time.Snapshot();
+        snapshot.reconnect_time = reconnect_time.Snapshot();
+        return snapshot;
+    }
+
+    FeedMetricsSnapshot FeedMetrics::Snapshot() const
+    {
+        FeedMetricsSnapshot snapshot;
+        snapshot.uptime_sec = seconds_since(start_);
+        snapshot.reads = reads.Load();
+        snapshot.datagrams = datagrams.Load();
+        snapshot.bytes_in = bytes_in.Load();
+        snapshot.msgs_in = msgs_in.Load();
+        snapshot.gaps = gaps.Load();
+        snapshot.lost = lost.Load();
+        snapshot.stale = stale.Load();
+        snapshot.errors = errors.Load();
+        snapshot.datagrams_per_read = datagrams_per_read.Snapshot();
+        return snapshot;
+    }
+
+    //----------------------------------------------------------------------
+
+    static void format_rate(std::ostringstream& out, const char* name, std::uint64_t value, double uptime_sec)
+    {
+        out << std::left << std::setw(18) << name << value;
+        if (uptime_sec > 0)
+            out << " (" << std::fixed << std::setprecision(1) << double(value) / uptime_sec << "/s)";
+        out << "\n";
+    }
+
+    static void format_latency(std::ostringstream& out, const char* name, const HistogramSnapshot& h)
+    {
+        // Recorded in nanoseconds, printed in microseconds.
+        out << std::left << std::setw(18) << name << std::fixed << std::setprecision(1)
+            << "n=" << h.count
+            << " mean=" << h.Mean() / 1000.0
+            << " p50=" << h.Percentile(0.50) / 1000.0
+            << " p99=" << h.Percentile(0.99) / 1000.0
+            << " p999=" << h.Percentile(0.999) / 1000.0
+            << " max=" << h.max / 1000.0 << " us\n";
+    }
+
+    static void format_count(std::ostringstream& out, const char* name, const HistogramSnapshot& h)
+    {
+        out << std::left << std::setw(18) << name << std::fixed << std::setprecision(1)
+            << "n=" << h.count
+            << " mean=" << h.Mean()
+            << " p50=" << h.Percentile(0.50)
+            << " p99=" << h.Percentile(0.99)
+            << " max=" << h.max << "\n";
+    }
+
+    std::string FormatMetrics(const ServerMetricsSnapshot& snapshot)
+    {
+        std::ostringstream out;
+        out << std::left << std::setw(18) << "uptime" << std::fixed << std::setprecision(1) << snapshot.uptime_sec << " s\n";
+        format_rate(out, "accepts", snapshot.accepts, snapshot.uptime_sec);
+        format_rate(out, "accept_errors", snapshot.accept_errors, snapshot.uptime_sec);
+        format_rate(out, "disconnects", snapshot.disconnects, snapshot.uptime_sec);
+        format_rate(out, "timeouts", snapshot.timeouts, snapshot.uptime_sec);
+        format_rate(out, "reads", snapshot.reads, snapshot.uptime_sec);
+        format_rate(out, "writes", snapshot.writes, snapshot.uptime_sec);
+        format_rate(out, "bytes_in", snapshot.bytes_in, snapshot.uptime_sec);
+        format_rate(out, "bytes_out", snapshot.bytes_out, snapshot.uptime_sec);
+        format_rate(out, "msgs_in", snapshot.msgs_in, snapshot.uptime_sec);
+        format_rate(out, "msgs_out", snapshot.msgs_out, snapshot.uptime_sec);
+        format_rate(out, "heartbeats", snapshot.heartbeats, snapshot.uptime_sec);
+        format_rate(out, "overflow_disconn", snapshot.overflow_disconnects, snapshot.uptime_sec);
+        format_rate(out, "dropped", snapshot.dropped, snapshot.uptime_sec);
+        format_rate(out, "conflated", snapshot.conflated, snapshot.uptime_sec);
+        format_rate(out, "datagrams", snapshot.datagrams, snapshot.uptime_sec);
+        format_rate(out, "datagram_errors", snapshot.datagram_errors, snapshot.uptime_sec);
+        format_rate(out, "compressed_sess", snapshot.compressed_sessions, snapshot.uptime_sec);
+        format_rate(out, "compress_refused", snapshot.compression_refused, snapshot.uptime_sec);
+        format_rate(out, "compressed", snapshot.compressed, snapshot.uptime_sec);
+        format_rate(out, "compress_in", snapshot.compress_bytes_in, snapshot.uptime_sec);
+        format_rate(out, "compress_out", snapshot.compress_bytes_out, snapshot.uptime_sec);
+        format_count(out, "frames_per_read", snapshot.frames_per_read);
+        format_count(out, "dgrams_per_send", snapshot.datagrams_per_send);
+        format_latency(out, "write_time", snapshot.write_time);
+        format_latency(out, "deliver_to_wire", snapshot.deliver_to_wire);
+
+        // Deepest queues first, those are the slow consumers.
+        std::vector<const SessionStats*> sessions;
+        for (const auto& s : snapshot.sessions)
+            sessions.push_back(&s);
+        std::sort(sessions.begin(), sessions.end(), [](const SessionStats* a, const SessionStats* b)
+        {
+            return a->queue_depth > b->queue_depth;
+        });
+
+        out << "sessions          " << sessions.size() << "\n";
+        for (const auto* s : sessions)
+        {
+            out << "  #" << s->id << " " << s->host << ":" << s->port
+                << " queue=" << s->queue_depth << "/" << s->queued_bytes << "B max_queue=" << s->max_queue_depth
+                << " in=" << s->msgs_in << "/" << s->bytes_in << "B"
+                << " out=" << s->msgs_out << "/" << s->bytes_out << "B"
+                << (s->dropped ? " dropped=" + std::to_string(s->dropped) : std::string())
+                << (s->conflated ? " conflated=" + std::to_string(s->conflated) : std::string())
+                << (s->write_in_flight ? " writing" : "") << "\n";
+        }
+        return out.str();
+    }
+
+    std::string FormatMetrics(const ClientMetricsSnapshot& snapshot)
+    {
+        std::ostringstream out;
+        out << std::left << std::setw(18) << "uptime" << std::fixed << std::setprecision(1) << snapshot.uptime_sec << " s\n";
+        format_rate(out, "connects", snapshot.connects, snapshot.uptime_sec);
+        format_rate(out, "disconnects", snapshot.disconnects, snapshot.uptime_sec);
+        format_rate(out, "timeouts", snapshot.timeouts, snapshot.uptime_sec);
+        format_rate(out, "reads", snapshot.reads, snapshot.uptime_sec);
+        format_rate(out, "writes", snapshot.writes, snapshot.uptime_sec);
+        format_rate(out, "bytes_in", snapshot.bytes_in, snapshot.uptime_sec);
+        format_rate(out, "bytes_out", snapshot.bytes_out, snapshot.uptime_sec);
+        format_rate(out, "msgs_in", snapshot.msgs_in, snapshot.uptime_sec);
+        format_rate(out, "msgs_out", snapshot.msgs_out, snapshot.uptime_sec);
+        format_rate(out, "high_water_marks", snapshot.high_water_marks, snapshot.uptime_sec);
+        format_rate(out, "recv_stalls", snapshot.recv_stalls, snapshot.uptime_sec);
+        format_rate(out, "reconnects", snapshot.reconnects, snapshot.uptime_sec);
+        format_rate(out, "decompressed", snapshot.decompressed, snapshot.uptime_sec);
+        out << std::left << std::setw(18) << "queued_bytes" << snapshot.queued_bytes << "\n";
+        format_count(out, "frames_per_read", snapshot.frames_per_read);
+        format_latency(out, "write_time", snapshot.write_time);
+        format_latency(out, "reconnect_time", snapshot.reconnect_time);
+        return out.str();
+    }
+
+    std::string FormatMetrics(const ClientPoolMetricsSnapshot& snapshot)
+    {
+        std::ostringstream out;
+        out << std::left << std::setw(18) << "connections" << snapshot.connections << "\n";
+        out << std::left << std::setw(18) << "connected" << snapshot.connected << "\n";
+        out << std::left << std::setw(18) << "saturated" << snapshot.saturated << "\n";
+        out << FormatMetrics(snapshot.clients);
+        return out.str();
+    }
+
+    std::string FormatMetrics(const FeedMetricsSnapshot& snapshot)
+    {
+        std::ostringstream out;
+        out << std::left << std::setw(18) << "uptime" << std::fixed << std::setprecision(1) << snapshot.uptime_sec << " s\n";
+        format_rate(out, "reads", snapshot.reads, snapshot.uptime_sec);
+        format_rate(out, "datagrams", snapshot.datagrams, snapshot.uptime_sec);
+        format_rate(out, "bytes_in", snapshot.bytes_in, snapshot.uptime_sec);
+        format_rate(out, "msgs_in", snapshot.msgs_in, snapshot.uptime_sec);
+        format_rate(out, "gaps", snapshot.gaps, snapshot.uptime_sec);
+        format_rate(out, "lost", snapshot.lost, snapshot.uptime_sec);
+        format_rate(out, "stale", snapshot.stale, snapshot.uptime_sec);
+        format_rate(out, "errors", snapshot.errors, snapshot.uptime_sec);
+        format_count(out, "dgrams_per_read", snapshot.datagrams_per_read);
+        return out.str();
+    }
+}
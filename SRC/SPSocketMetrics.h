@@ -0,0 +1,302 @@
+#ifndef _SP_SOCKET_METRICS_H_
+#define _SP_SOCKET_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace SPSocket
+{
+    // Adds to an atomic that only one thread ever writes, e.g. a per-session
+    // counter. Readers on other threads see a consistent, if slightly stale, value
+    // without the writer paying for a locked read-modify-write.
+    inline void BumpRelaxed(std::atomic<std::uint64_t>& value, std::uint64_t n = 1)
+    {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    //
+    // A counter that any thread may add to without contention. Each thread adds
+    // to its own cache line sized shard with a relaxed atomic, Load() sums them.
+    //
+    class Counter {
+    public:
+
+        void Add(std::uint64_t n = 1);
+        std::uint64_t Load() const;
+
+        static constexpr std::size_t shard_count = 16;
+
+    private:
+
+        struct alignas(64) shard {
+            std::atomic<std::uint64_t> value{ 0 };
+        };
+
+        shard shards_[shard_count];
+    };
+
+    //----------------------------------------------------------------------
+
+    // Percentiles and the like, computed from a copy of a Histogram's buckets
+    struct HistogramSnapshot {
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+        std::uint64_t max = 0;
+        std::vector<std::uint64_t> buckets;
+
+        // q in [0, 1], e.g. 0.99. Reports the upper bound of the bucket the
+        // percentile falls into, so at most 12.5% above the real value.
+        std::uint64_t Percentile(double q) const;
+        double Mean() const { return count > 0 ? double(sum) / double(count) : 0.0; }
+    };
+
+    //
+    // A log-linear histogram in the style of HdrHistogram: every power of two is
+    // split into 8 linear sub-buckets, so any 64 bit value is recorded in O(1)
+    // with a relative error of at most 12.5%, in a fixed 496 buckets. Recording
+    // is a few relaxed atomic adds and never takes a lock. A histogram shared by
+    // several I/O threads is split into shards like a Counter, each thread
+    // records into its own and Snapshot() merges them. One recorded by a single
+    // thread, e.g. a client's, has one shard of 4KB. Values are whatever the
+    // caller records, latencies are recorded in nanoseconds.
+    //
+    class Histogram {
+    public:
+
+        explicit Histogram(std::size_t shards = 1);
+
+        void Record(std::uint64_t value);
+
+        template <typename Rep, typename Period>
+        void Record(std::chrono::duration<Rep, Period> d)
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+            Record(static_cast<std::uint64_t>(ns > 0 ? ns : 0));
+        }
+
+        HistogramSnapshot Snapshot() const;
+
+        static constexpr std::size_t sub_bucket_bits = 3;
+        static constexpr std::size_t sub_bucket_count = std::size_t(1) << sub_bucket_bits;
+        static constexpr std::size_t bucket_count = sub_bucket_count + (64 - sub_bucket_bits) * sub_bucket_count;
+
+        static std::size_t BucketIndex(std::uint64_t value);
+        static std::uint64_t BucketUpperBound(std::size_t index);
+
+        // For histograms shared by I/O threads, fewer than a Counter's as a shard is 4KB
+        static constexpr std::size_t shared_shard_count = 8;
+
+    private:
+
+        struct alignas(64) shard {
+            std::atomic<std::uint64_t> buckets[bucket_count] = {};
+            std::atomic<std::uint64_t> sum{ 0 };
+            std::atomic<std::uint64_t> max{ 0 };
+        };
+
+        std::size_t shard_count_;
+        std::unique_ptr<shard[]> shards_;
+    };
+
+    //----------------------------------------------------------------------
+
+    // One connected client as seen by the server at the time of the snapshot
+    struct SessionStats {
+        std::uint64_t id = 0;
+        std::string host;
+        unsigned short port = 0;
+        std::uint64_t bytes_in = 0;
+        std::uint64_t bytes_out = 0;
+        std::uint64_t msgs_in = 0;
+        std::uint64_t msgs_out = 0;
+        std::uint64_t queue_depth = 0;          // messages waiting to be written
+        std::uint64_t max_queue_depth = 0;
+        std::uint64_t queued_bytes = 0;
+        std::uint64_t dropped = 0;              // by the overflow policy
+        std::uint64_t conflated = 0;
+        bool write_in_flight = false;
+    };
+
+    struct ServerMetricsSnapshot {
+        double uptime_sec = 0;
+        std::uint64_t accepts = 0;
+        std::uint64_t accept_errors = 0;
+        std::uint64_t disconnects = 0;
+        std::uint64_t timeouts = 0;
+        std::uint64_t reads = 0;
+        std::uint64_t writes = 0;
+        std::uint64_t bytes_in = 0;
+        std::uint64_t bytes_out = 0;
+        std::uint64_t msgs_in = 0;
+        std::uint64_t msgs_out = 0;
+        std::uint64_t heartbeats = 0;
+        std::uint64_t overflow_disconnects = 0;
+        std::uint64_t dropped = 0;
+        std::uint64_t conflated = 0;
+        std::uint64_t datagrams = 0;
+        std::uint64_t datagram_errors = 0;
+        std::uint64_t compressed_sessions = 0;  // clients that asked for compression
+        std::uint64_t compression_refused = 0;  // ... with another dictionary, or none here
+        std::uint64_t compressed = 0;           // messages compressed, once for all those clients
+        std::uint64_t compress_bytes_in = 0;
+        std::uint64_t compress_bytes_out = 0;
+        HistogramSnapshot frames_per_read;
+        HistogramSnapshot datagrams_per_send;
+        HistogramSnapshot write_time;           // ns an async_write was in flight
+        HistogramSnapshot deliver_to_wire;      // ns from deliver() until written
+        std::vector<SessionStats> sessions;
+    };
+
+    //
+    // Server-wide counters, shared by all sessions of a server whatever thread
+    // they run on. Nothing in here takes a lock.
+    //
+    class ServerMetrics {
+    public:
+
+        ServerMetrics() : start_(std::chrono::steady_clock::now()) {}
+
+        Counter accepts;
+        Counter accept_errors;
+        Counter disconnects;
+        Counter timeouts;
+        Counter reads;
+        Counter writes;
+        Counter bytes_in;
+        Counter bytes_out;
+        Counter msgs_in;
+        Counter msgs_out;
+        Counter heartbeats;
+        Counter overflow_disconnects;           // slow consumers, see OverflowPolicy
+        Counter dropped;
+        Counter conflated;
+        Counter compressed_sessions;
+        Counter compression_refused;
+        Histogram frames_per_read{ Histogram::shared_shard_count };
+        Histogram write_time{ Histogram::shared_shard_count };
+        Histogram deliver_to_wire{ Histogram::shared_shard_count };
+
+        // Everything but the sessions and the UDP broadcast (datagrams, one per
+        // message and endpoint), which the server adds
+        ServerMetricsSnapshot Snapshot() const;
+
+    private:
+
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    struct ClientMetricsSnapshot {
+        double uptime_sec = 0;
+        std::uint64_t connects = 0;
+        std::uint64_t disconnects = 0;
+        std::uint64_t timeouts = 0;
+        std::uint64_t reads = 0;
+        std::uint64_t writes = 0;
+        std::uint64_t bytes_in = 0;
+        std::uint64_t bytes_out = 0;
+        std::uint64_t msgs_in = 0;
+        std::uint64_t msgs_out = 0;
+        std::uint64_t queued_bytes = 0;
+        std::uint64_t high_water_marks = 0;
+        std::uint64_t recv_stalls = 0;          // reads parked on a full polling queue
+        std::uint64_t reconnects = 0;
+        std::uint64_t decompressed = 0;         // messages received compressed
+        HistogramSnapshot frames_per_read;
+        HistogramSnapshot write_time;
+        HistogramSnapshot reconnect_time;       // connection lost until connected again
+    };
+
+    class ClientMetrics {
+    public:
+
+        // One histogram shard for a single client, Histogram::shared_shard_count for
+        // a pool of clients on several threads
+        explicit ClientMetrics(std::size_t histogram_shards = 1)
+            : frames_per_read(histogram_shards),
+            write_time(histogram_shards),
+            reconnect_time(histogram_shards),
+            start_(std::chrono::steady_clock::now())
+        {}
+
+        Counter connects;
+        Counter disconnects;
+        Counter timeouts;
+        Counter reads;
+        Counter writes;
+        Counter bytes_in;
+        Counter bytes_out;
+        Counter msgs_in;
+        Counter msgs_out;
+        Counter high_water_marks;
+        Counter recv_stalls;
+        Counter reconnects;
+        Counter decompressed;
+        Histogram frames_per_read;
+        Histogram write_time;
+        Histogram reconnect_time;
+
+        // Everything but the queued bytes, which the client adds
+        ClientMetricsSnapshot Snapshot() const;
+
+    private:
+
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // A pool of client connections recording into one ClientMetrics
+    struct ClientPoolMetricsSnapshot {
+        std::uint64_t connections = 0;
+        std::uint64_t connected = 0;
+        std::uint64_t saturated = 0;            // connected, but too much queued to take sends
+        ClientMetricsSnapshot clients;          // all connections together
+    };
+
+    struct FeedMetricsSnapshot {
+        double uptime_sec = 0;
+        std::uint64_t reads = 0;
+        std::uint64_t datagrams = 0;
+        std::uint64_t bytes_in = 0;
+        std::uint64_t msgs_in = 0;
+        std::uint64_t gaps = 0;
+        std::uint64_t lost = 0;                 // messages missing from the gaps
+        std::uint64_t stale = 0;                // late or duplicate, dropped
+        std::uint64_t errors = 0;
+        HistogramSnapshot datagrams_per_read;
+    };
+
+    // Receiving side of the UDP feed, see SPSocketUDPClient
+    class FeedMetrics {
+    public:
+
+        FeedMetrics() : start_(std::chrono::steady_clock::now()) {}
+
+        Counter reads;
+        Counter datagrams;
+        Counter bytes_in;
+        Counter msgs_in;
+        Counter gaps;
+        Counter lost;
+        Counter stale;
+        Counter errors;
+        Histogram datagrams_per_read;
+
+        FeedMetricsSnapshot Snapshot() const;
+
+    private:
+
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // Human readable dumps, one item per line, e.g. for a periodic log
+    std::string FormatMetrics(const ServerMetricsSnapshot& snapshot);
+    std::string FormatMetrics(const ClientMetricsSnapshot& snapshot);
+    std::string FormatMetrics(const ClientPoolMetricsSnapshot& snapshot);
+    std::string FormatMetrics(const FeedMetricsSnapshot& snapshot);
+}
+
+#endif
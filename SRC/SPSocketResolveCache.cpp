@@ -0,0 +1,128 @@
+#include "SPSocketResolveCache.h"
+
+#include <boost/asio/post.hpp>
+
+namespace SPSocket
+{
+    ResolveCache& ResolveCache::Shared()
+    {
+        static ResolveCache cache;
+        return cache;
+    }
+
+    ResolveCache::ResolveCache(std::size_t resolver_threads)
+        : pool_(resolver_threads > 0 ? resolver_threads : 1, false)
+    {
+        pool_.Run();
+    }
+
+    ResolveCache::~ResolveCache() noexcept
+    {
+        // Queries still running are abandoned, their waiters never hear back.
+        pool_.Stop();
+    }
+
+    void ResolveCache::UseTimeToLive(std::chrono::milliseconds ttl)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        ttl_ = ttl;
+    }
+
+    ResolveCache::lookup_ptr ResolveCache::AsyncResolve(const boost::asio::any_io_executor& executor, const std::string& host, const std::string& service, ResolveHandler handler)
+    {
+        auto lookup = std::make_shared<Lookup>(std::move(handler));
+        waiter w{ executor, lookup };
+
+        key_type key(host, service);
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            entry& e = entries_[key];
+
+            if (!e.pending && !e.results.empty() && e.expiry > std::chrono::steady_clock::now())
+            {
+                post_result(w, boost::system::error_code(), e.results);
+                return lookup;
+            }
+
+            e.waiters.push_back(std::move(w));
+
+            // Someone else's query is already on its way.
+            if (e.pending)
+                return lookup;
+            e.pending = true;
+        }
+
+        // A resolver per query, it only lives until the query completes. Its
+        // io_context's resolver thread does the blocking part.
+        auto resolver = std::make_shared<tcp::resolver>(pool_.GetIOContext());
+        resolver->async_resolve(key.first, key.second,
+            [this, key, resolver](const boost::system::error_code& error, const tcp::resolver::results_type& results)
+        {
+            complete(key, error, results);
+        });
+        return lookup;
+    }
+
+    void ResolveCache::complete(const key_type& key, const boost::system::error_code& error, const tcp::resolver::results_type& results)
+    {
+        std::vector<waiter> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto it = entries_.find(key);
+            if (it == entries_.end())
+                return;
+
+            waiters.swap(it->second.waiters);
+            if (error || results.empty() || ttl_.count() <= 0)
+            {
+                entries_.erase(it);
+            }
+            else
+            {
+                it->second.pending = false;
+                it->second.results = results;
+                it->second.expiry = std::chrono::steady_clock::now() + ttl_;
+            }
+        }
+
+        for (const auto& w : waiters)
+            post_result(w, error, results);
+    }
+
+    void ResolveCache::post_result(const waiter& w, const boost::system::error_code& error, const tcp::resolver::results_type& results)
+    {
+        // Waiters that are gone are skipped. The lookup is checked again on the
+        // waiter's own thread, where it would be destroyed.
+        if (w.lookup.expired())
+            return;
+
+        std::weak_ptr<Lookup> weak = w.lookup;
+        boost::asio::post(w.executor, [weak, error, results]()
+        {
+            if (lookup_ptr lookup = weak.lock())
+                lookup->handler_(error, results);
+        });
+    }
+
+    void ResolveCache::Clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (auto it = entries_.begin(); it != entries_.end();)
+        {
+            if (it->second.pending)
+            {
+                ++it;
+            }
+            else
+            {
+                it = entries_.erase(it);
+            }
+        }
+    }
+
+    std::size_t ResolveCache::Size() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return entries_.size();
+    }
+}
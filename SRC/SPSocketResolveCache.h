@@ -0,0 +1,113 @@
+#ifndef _SP_SOCKET_RESOLVE_CACHE_H_
+#define _SP_SOCKET_RESOLVE_CACHE_H_
+
+#include "SPSocketIOContextPool.h"
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace SPSocket
+{
+    using boost::asio::ip::tcp;
+
+    //
+    // Name resolution results shared by every SPSocketClient in the process, each
+    // kept for a time-to-live (default 60 seconds). A lookup that finds a fresh
+    // entry completes without touching the resolver at all.
+    //
+    // Lookups of the same name that arrive while it is being resolved wait for
+    // that one async_resolve instead of starting their own, so a thousand clients
+    // connecting to one host at once cost a single query. Queries are spread
+    // round-robin over a small io_context pool of the cache's own, each with a
+    // resolver thread of its own, so different names resolve concurrently and
+    // no caller's lifetime is tied to anyone else's lookup. Every waiter's
+    // handler is posted to the executor it passed in, i.e. it runs on its own
+    // client's io_context thread, never inline. Failures are handed to all
+    // waiters but not cached, the next lookup tries again.
+    //
+    class ResolveCache {
+    public:
+
+        typedef std::function<void(const boost::system::error_code& error, const tcp::resolver::results_type& results)> ResolveHandler;
+
+        // One caller's wait for a result. The cache only keeps a weak reference,
+        // so destroying it is all it takes to cancel, without affecting anyone
+        // else waiting for the same query.
+        class Lookup {
+        public:
+            explicit Lookup(ResolveHandler handler) : handler_(std::move(handler)) {}
+
+        private:
+            friend class ResolveCache;
+
+            ResolveHandler handler_;
+        };
+
+        typedef std::shared_ptr<Lookup> lookup_ptr;
+
+        // The instance the clients use
+        static ResolveCache& Shared();
+
+        // Names that can be resolved at the same time, by default
+        static constexpr std::size_t default_resolver_threads = 4;
+
+        explicit ResolveCache(std::size_t resolver_threads = default_resolver_threads);
+        ~ResolveCache() noexcept;
+
+        ResolveCache(const ResolveCache&) = delete;
+        ResolveCache& operator=(const ResolveCache&) = delete;
+
+        // How long results are reused, 0 = resolve every time (concurrent lookups
+        // are still shared). Safe to call from any thread.
+        void UseTimeToLive(std::chrono::milliseconds ttl);
+
+        // Resolves host:service, from the cache if possible, and posts the handler
+        // to executor. Safe to call from any thread. The handler only runs while
+        // the returned lookup is alive.
+        lookup_ptr AsyncResolve(const boost::asio::any_io_executor& executor, const std::string& host, const std::string& service, ResolveHandler handler);
+
+        // Forgets every cached result, lookups in progress are not affected
+        void Clear();
+
+        // Names cached or being resolved
+        std::size_t Size() const;
+
+    private:
+
+        typedef std::pair<std::string, std::string> key_type;
+
+        struct waiter {
+            boost::asio::any_io_executor executor;
+            std::weak_ptr<Lookup> lookup;
+        };
+
+        struct entry {
+            tcp::resolver::results_type results;
+            std::chrono::steady_clock::time_point expiry;
+            bool pending = false;
+            std::vector<waiter> waiters;
+        };
+
+        void complete(const key_type& key, const boost::system::error_code& error, const tcp::resolver::results_type& results);
+        static void post_result(const waiter& w, const boost::system::error_code& error, const tcp::resolver::results_type& results);
+
+        mutable std::mutex mtx_;
+        std::map<key_type, entry> entries_;
+        std::chrono::milliseconds ttl_{ 60 * 1000 };
+
+        // The queries' own io_contexts, running for as long as the cache lives
+        IOContextPool pool_;
+    };
+}
+
+#endif
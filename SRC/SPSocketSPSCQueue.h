@@ -0,0 +1,142 @@
+#ifndef _SP_SOCKET_SPSC_QUEUE_H_
+#define _SP_SOCKET_SPSC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace SPSocket
+{
+    //
+    // Bounded lock-free single-producer / single-consumer ring.
+    //
+    // The producer is the only one to write tail_, the consumer the only one to
+    // write head_, and each sits on a cache line of its own, so neither side ever
+    // takes a lock or writes a line the other one writes. Each side also keeps a
+    // private copy of the other's index and only reloads it when the ring looks
+    // full (producer) or empty (consumer), so the shared lines are not pulled
+    // across cores on every element.
+    //
+    // Slots are constructed once and reused. Claim() / Publish() let the producer
+    // fill a slot in place, e.g. assign into a string that kept its capacity from
+    // an earlier message, and Consume() hands out a batch of slots in place and
+    // releases them with a single store.
+    //
+    template <typename T>
+    class SPSCQueue {
+    public:
+
+        explicit SPSCQueue(std::size_t capacity = 1024)
+        {
+            Reset(capacity);
+        }
+
+        SPSCQueue(const SPSCQueue&) = delete;
+        SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+        // Drops the contents and resizes, rounding up to a power of two. Only while
+        // neither side is using the queue.
+        void Reset(std::size_t capacity)
+        {
+            std::size_t size = 2;
+            while (size < capacity)
+                size <<= 1;
+
+            slots_.reset(new T[size]);
+            mask_ = size - 1;
+            head_.store(0, std::memory_order_relaxed);
+            tail_.store(0, std::memory_order_relaxed);
+            cached_head_ = 0;
+            cached_tail_ = 0;
+        }
+
+        std::size_t Capacity() const { return mask_ + 1; }
+
+        // Producer only, the next free slot or nullptr if the ring is full. The slot
+        // still holds whatever an earlier element left in it.
+        T* Claim()
+        {
+            std::size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail - cached_head_ > mask_)
+            {
+                cached_head_ = head_.load(std::memory_order_acquire);
+                if (tail - cached_head_ > mask_)
+                    return nullptr;
+            }
+            return &slots_[tail & mask_];
+        }
+
+        // Producer only, hands the slot returned by Claim() to the consumer
+        void Publish()
+        {
+            tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // Producer only, returns false (and leaves value alone) if the ring is full
+        bool TryPush(T&& value)
+        {
+            T* slot = Claim();
+            if (!slot)
+                return false;
+
+            *slot = std::move(value);
+            Publish();
+            return true;
+        }
+
+        // Consumer only, hands up to max_items elements to f(T&) in FIFO order and
+        // returns how many there were. The elements stay in their slots, f may move
+        // them out or leave them for the producer to reuse.
+        template <typename F>
+        std::size_t Consume(F&& f, std::size_t max_items = SIZE_MAX)
+        {
+            std::size_t head = head_.load(std::memory_order_relaxed);
+            if (cached_tail_ == head)
+            {
+                cached_tail_ = tail_.load(std::memory_order_acquire);
+                if (cached_tail_ == head)
+                    return 0;
+            }
+
+            std::size_t count = std::min(cached_tail_ - head, max_items);
+            for (std::size_t i = 0; i < count; ++i)
+                f(slots_[(head + i) & mask_]);
+
+            head_.store(head + count, std::memory_order_release);
+            return count;
+        }
+
+        // Consumer only, moves the oldest element out
+        bool TryPop(T& value)
+        {
+            return Consume([&value](T& slot) { value = std::move(slot); }, 1) == 1;
+        }
+
+        // Snapshots only, may be stale by the time they return
+        std::size_t Size() const
+        {
+            // Head first, it can only have moved towards a tail loaded after it.
+            std::size_t head = head_.load(std::memory_order_acquire);
+            return tail_.load(std::memory_order_acquire) - head;
+        }
+        bool Empty() const { return Size() == 0; }
+
+    private:
+
+        static constexpr std::size_t cache_line = 64;
+
+        alignas(cache_line) std::atomic<std::size_t> head_{ 0 };     // written by the consumer
+        std::size_t cached_tail_ = 0;
+
+        alignas(cache_line) std::atomic<std::size_t> tail_{ 0 };     // written by the producer
+        std::size_t cached_head_ = 0;
+
+        alignas(cache_line) std::unique_ptr<T[]> slots_;
+        std::size_t mask_ = 0;
+    };
+}
+
+#endif
@@ -8,55 +8,556 @@
 
 #include "SPSocketServer.h"
 
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <cerrno>
+#endif
+
 namespace SPSocket
 {
-    TCP_Session::TCP_Session(tcp::socket socket, Channel& ch, SPSocketServerPtr sp)
-        : channel_(ch), socket_(std::move(socket)), socket_server_(sp)
+    static std::atomic<std::uint64_t> next_session_id{ 1 };
+
+    Channel::Channel()
+    {
+        auto table = std::make_shared<routing_table>();
+        table->blocks = std::make_shared<block_list>();
+        table->topics = std::make_shared<topic_map>();
+        table_ = std::move(table);
+    }
+
+    Channel::~Channel() noexcept
+    {
+        clear_cache();
+    }
+
+    void Channel::UseLastValueCache(const MessageKey& key)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        clear_cache();
+        cache_key_ = key;
+        if (cache_key_)
+            cache_.reset(new std::atomic<cached_value*>[cache_buckets]());
+    }
+
+    void Channel::clear_cache()
+    {
+        if (!cache_)
+            return;
+
+        for (std::size_t i = 0; i < cache_buckets; ++i)
+        {
+            for (cached_value* n = cache_[i].load(std::memory_order_relaxed); n; )
+            {
+                cached_value* next = n->next;
+                delete n;
+                n = next;
+            }
+        }
+        cache_.reset();
+        cache_count_.store(0, std::memory_order_relaxed);
+    }
+
+    Channel::slot_block& Channel::copy_block(routing_table& table, std::uint32_t slot)
+    {
+        auto blocks = std::make_shared<block_list>(*table.blocks);
+        if (slot / block_size == blocks->size())
+            blocks->push_back(std::make_shared<slot_block>());
+
+        auto block = std::make_shared<slot_block>(*(*blocks)[slot / block_size]);
+        slot_block& copy = *block;
+        (*blocks)[slot / block_size] = std::move(block);
+        table.blocks = std::move(blocks);
+        return copy;
+    }
+
+    void Channel::Join(subscriber_ptr subscriber)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (members_.count(subscriber.get()) > 0)
+                return;
+
+            std::uint32_t slot;
+            if (!free_slots_.empty())
+            {
+                slot = free_slots_.back();
+                free_slots_.pop_back();
+            }
+            else
+            {
+                slot = slot_count_++;
+            }
+            members_.emplace(subscriber.get(), member{ slot, 0 });
+
+            auto table = std::make_shared<routing_table>(*load_table());
+            copy_block(*table, slot).subscribers[slot % block_size] = subscriber;
+            std::atomic_store(&table_, table_ptr(std::move(table)));
+        }
+
+        // Outside the lock, a large cache must not hold up other joins and leaves.
+        // Delivering to a subscriber that has left meanwhile is harmless.
+        if (cache_)
+            deliver_cache(subscriber);
+    }
+
+    void Channel::deliver_cache(const subscriber_ptr& subscriber)
     {
-        input_deadline_.expires_at(steady_timer::time_point::max());
-        output_deadline_.expires_at(steady_timer::time_point::max());
+        // The subscriber is in the table already, so a delivery caching a message
+        // after the scan below has read its key delivers it live. One that cached
+        // it before may still be about to deliver it, and an older message could
+        // then land after its own in the subscriber's queue. So the keys are read
+        // again once the snapshot went out, and those that changed sent again.
+        // On a busy feed some key changes on every pass, so this stops after
+        // cache_rechecks passes, the next update of a key corrects it anyway.
+        std::vector<std::pair<cached_value*, message_ptr>> sent;
+        sent.reserve(cache_count_.load());
+        for (std::size_t i = 0; i < cache_buckets; ++i)
+        {
+            for (cached_value* n = cache_[i].load(); n; n = n->next)
+                sent.emplace_back(n, std::atomic_load(&n->value));
+        }
 
-        // The non_empty_output_queue_ steady_timer is set to the maximum time
-        // point whenever the output queue is empty. This ensures that the output
-        // actor stays asleep until a message is put into the queue.
-        non_empty_output_queue_.expires_at(steady_timer::time_point::max());
+        std::vector<message_ptr> batch;
+        batch.reserve(sent.size());
+        for (const auto& s : sent)
+            batch.push_back(s.second);
+
+        for (int pass = 0; pass <= cache_rechecks && !batch.empty(); ++pass)
+        {
+            subscriber->deliver(batch);
+            batch.clear();
+            if (pass == cache_rechecks)
+                break;
+
+            for (auto& s : sent)
+            {
+                message_ptr latest = std::atomic_load(&s.first->value);
+                if (latest != s.second)
+                {
+                    s.second = latest;
+                    batch.push_back(std::move(latest));
+                }
+            }
+        }
+    }
+
+    void Channel::Leave(subscriber_ptr subscriber)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = members_.find(subscriber.get());
+        if (it == members_.end())
+            return;
+
+        const std::uint32_t slot = it->second.slot;
+        const bool subscribed = it->second.topics > 0;
+        members_.erase(it);
+
+        auto table = std::make_shared<routing_table>(*load_table());
+        slot_block& block = copy_block(*table, slot);
+        block.subscribers[slot % block_size].reset();
+        if (block.compressed[slot % block_size])
+        {
+            block.compressed[slot % block_size] = false;
+            --table->compressed_count;
+        }
+
+        // The topic map is only copied if the subscriber is in it at all.
+        if (subscribed)
+        {
+            auto topics = std::make_shared<topic_map>(*table->topics);
+            for (auto topic = topics->begin(); topic != topics->end(); )
+            {
+                const slot_list& slots = *topic->second;
+                auto pos = std::lower_bound(slots.begin(), slots.end(), slot);
+                if (pos != slots.end() && *pos == slot)
+                {
+                    if (slots.size() == 1)
+                    {
+                        topic = topics->erase(topic);
+                        continue;
+                    }
+                    auto copy = std::make_shared<slot_list>(slots);
+                    copy->erase(copy->begin() + (pos - slots.begin()));
+                    topic->second = std::move(copy);
+                }
+                ++topic;
+            }
+            table->topics = std::move(topics);
+        }
+        std::atomic_store(&table_, table_ptr(std::move(table)));
+
+        // Only reused once the old tables are gone or no longer reach it.
+        free_slots_.push_back(slot);
+    }
+
+    bool Channel::Subscribe(const subscriber_ptr& subscriber, const std::string& topic)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = members_.find(subscriber.get());
+        if (it == members_.end())
+            return false;
+
+        const std::uint32_t slot = it->second.slot;
+        table_ptr current = load_table();
+        auto existing = current->topics->find(topic);
+        if (existing != current->topics->end() && std::binary_search(existing->second->begin(), existing->second->end(), slot))
+            return true;
+
+        // Kept sorted, so a publish walks the subscribers front to back.
+        auto slots = existing != current->topics->end() ? std::make_shared<slot_list>(*existing->second) : std::make_shared<slot_list>();
+        slots->insert(std::upper_bound(slots->begin(), slots->end(), slot), slot);
+
+        auto topics = std::make_shared<topic_map>(*current->topics);
+        (*topics)[topic] = std::move(slots);
+
+        auto table = std::make_shared<routing_table>(*current);
+        table->topics = std::move(topics);
+        std::atomic_store(&table_, table_ptr(std::move(table)));
+        ++it->second.topics;
+        return true;
+    }
+
+    bool Channel::Unsubscribe(const subscriber_ptr& subscriber, const std::string& topic)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = members_.find(subscriber.get());
+        if (it == members_.end())
+            return false;
+
+        const std::uint32_t slot = it->second.slot;
+        table_ptr current = load_table();
+        auto existing = current->topics->find(topic);
+        if (existing == current->topics->end())
+            return true;
+
+        const slot_list& slots = *existing->second;
+        auto pos = std::lower_bound(slots.begin(), slots.end(), slot);
+        if (pos == slots.end() || *pos != slot)
+            return true;
+
+        auto topics = std::make_shared<topic_map>(*current->topics);
+        if (slots.size() == 1)
+        {
+            topics->erase(topic);
+        }
+        else
+        {
+            auto copy = std::make_shared<slot_list>(slots);
+            copy->erase(copy->begin() + (pos - slots.begin()));
+            (*topics)[topic] = std::move(copy);
+        }
+
+        auto table = std::make_shared<routing_table>(*current);
+        table->topics = std::move(topics);
+        std::atomic_store(&table_, table_ptr(std::move(table)));
+        --it->second.topics;
+        return true;
+    }
+
+    bool Channel::UseCompressedDelivery(const subscriber_ptr& subscriber, bool enable)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = members_.find(subscriber.get());
+        if (it == members_.end())
+            return false;
+
+        const std::uint32_t slot = it->second.slot;
+        table_ptr current = load_table();
+        if (current->block_of(slot).compressed[slot % block_size] == enable)
+            return true;
+
+        auto table = std::make_shared<routing_table>(*current);
+        copy_block(*table, slot).compressed[slot % block_size] = enable;
+        if (enable)
+            ++table->compressed_count;
+        else
+            --table->compressed_count;
+        std::atomic_store(&table_, table_ptr(std::move(table)));
+        return true;
+    }
+
+    void Channel::Deliver(const message_ptr& msg)
+    {
+        table_ptr table = load_table_and_cache(&msg, 1);
+        message_ptr compressed = table->compressed_count > 0 ? compress(msg) : msg;
+
+        for (const auto& block : *table->blocks)
+        {
+            for (std::uint32_t i = 0; i < block_size; ++i)
+            {
+                const subscriber_ptr& s = block->subscribers[i];
+                if (!s)
+                    continue;
+
+                if (block->compressed[i])
+                    s->deliver(compressed, msg);
+                else
+                    s->deliver(msg);
+            }
+        }
+    }
+
+    void Channel::Deliver(const std::vector<message_ptr>& msgs)
+    {
+        table_ptr table = load_table_and_cache(msgs.data(), msgs.size());
+
+        std::vector<message_ptr> compressed;
+        if (table->compressed_count > 0)
+        {
+            compressed.reserve(msgs.size());
+            for (const auto& msg : msgs)
+                compressed.push_back(compress(msg));
+        }
+
+        for (const auto& block : *table->blocks)
+        {
+            for (std::uint32_t slot = 0; slot < block_size; ++slot)
+            {
+                const subscriber_ptr& s = block->subscribers[slot];
+                if (!s)
+                    continue;
+
+                if (block->compressed[slot])
+                {
+                    for (std::size_t i = 0; i < msgs.size(); ++i)
+                        s->deliver(compressed[i], msgs[i]);
+                }
+                else
+                {
+                    s->deliver(msgs);
+                }
+            }
+        }
+    }
+
+    void Channel::Publish(std::string_view topic, const message_ptr& msg)
+    {
+        table_ptr table = load_table();
+        auto it = table->topics->find(topic);
+        if (it == table->topics->end())
+            return;
+
+        // Compressed when the first subscriber that wants it comes up.
+        message_ptr compressed;
+        for (std::uint32_t slot : *it->second)
+        {
+            const slot_block& block = table->block_of(slot);
+            if (block.compressed[slot % block_size])
+            {
+                if (!compressed)
+                    compressed = compress(msg);
+                block.subscribers[slot % block_size]->deliver(compressed, msg);
+            }
+            else
+            {
+                block.subscribers[slot % block_size]->deliver(msg);
+            }
+        }
+    }
+
+    message_ptr Channel::compress(const message_ptr& msg) const
+    {
+        std::string out;
+        if (compressor_ && compressor_->Compress(*msg, out))
+            return MakeMessage(std::move(out));
+        return msg;
+    }
+
+    std::size_t Channel::SubscriberCount(std::string_view topic)
+    {
+        table_ptr table = load_table();
+        auto it = table->topics->find(topic);
+        return it != table->topics->end() ? it->second->size() : 0;
+    }
+
+    Channel::table_ptr Channel::load_table_and_cache(const message_ptr* msgs, std::size_t count)
+    {
+        // Without a cache there is nothing a Join has to be kept consistent with.
+        if (!cache_)
+            return load_table();
+
+        // Cached before the table is loaded: a join whose snapshot missed them
+        // has published its table before, see deliver_cache().
+        for (std::size_t i = 0; i < count; ++i)
+            cache(msgs[i]);
+        return load_table();
+    }
+
+    void Channel::cache(const message_ptr& msg)
+    {
+        std::string_view key = cache_key_(*msg);
+        if (key.empty())
+            return;
+
+        std::atomic<cached_value*>& bucket = cache_[std::hash<std::string_view>()(key) % cache_buckets];
+        std::unique_ptr<cached_value> added;
+        cached_value* head = bucket.load();
+        for (;;)
+        {
+            for (cached_value* n = head; n; n = n->next)
+            {
+                if (n->key == key)
+                {
+                    std::atomic_store(&n->value, msg);
+                    return;
+                }
+            }
+
+            // Only a key seen for the first time costs an allocation. If another
+            // delivery adds to the bucket first, look again, it may be the same key.
+            if (!added)
+                added.reset(new cached_value{ std::string(key), msg, nullptr });
+            added->next = head;
+            if (bucket.compare_exchange_weak(head, added.get()))
+            {
+                added.release();
+                cache_count_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    //----------------------------------------------------------------------
+
+    SessionHandle::SessionHandle(const std::shared_ptr<TCP_Session>& session)
+        : session_(session),
+        id_(session->GetId()),
+        host_(session->GetHost()),
+        port_(session->GetPort())
+    {
+    }
+
+    bool SessionHandle::Send(const std::string& msg) const
+    {
+        tcp_session_ptr session = session_.lock();
+        if (!session)
+            return false;
+
+        session->Send(msg);
+        return true;
+    }
+
+    bool SessionHandle::Send(const message_ptr& msg) const
+    {
+        tcp_session_ptr session = session_.lock();
+        if (!session)
+            return false;
+
+        session->Send(msg);
+        return true;
+    }
+
+    bool SessionHandle::Subscribe(const std::string& topic) const
+    {
+        tcp_session_ptr session = session_.lock();
+        return session && session->Subscribe(topic);
+    }
+
+    bool SessionHandle::Unsubscribe(const std::string& topic) const
+    {
+        tcp_session_ptr session = session_.lock();
+        return session && session->Unsubscribe(topic);
+    }
+
+    //----------------------------------------------------------------------
+
+    TCP_Session::TCP_Session(boost::asio::io_context& io_context, tcp::socket socket, Channel& ch, SPSocketServerPtr sp)
+        : socket_server_(sp), io_context_(io_context), timing_wheel_(TimingWheel::Get(io_context)), channel_(ch), socket_(std::move(socket))
+    {
     }
 
     void TCP_Session::UseReadUntil(char terminator)
     {
         read_terminator = terminator;
+        codec_.UseDelimiter(terminator);
+    }
+
+    void TCP_Session::UseFraming(const FrameCodec& codec)
+    {
+        codec_ = codec;
+        if (codec_.Mode() == FramingMode::F_DELIMITER)
+            read_terminator = codec_.Terminator();
+    }
+
+    void TCP_Session::UseWriteCoalescing(std::size_t max_bytes, std::size_t max_buffers)
+    {
+        write_max_bytes = max_bytes;
+        write_max_buffers = max_buffers > 0 ? max_buffers : 1;
+    }
+
+    void TCP_Session::UseOutputQueueLimit(std::size_t max_bytes, std::size_t max_msgs, OverflowPolicy policy)
+    {
+        queue_max_bytes = max_bytes;
+        queue_max_msgs = max_msgs;
+        overflow_policy = policy;
     }
 
     void TCP_Session::Start()
     {
-        channel_.Join(shared_from_this());
+        boost::system::error_code error;
+        tcp::endpoint remote = socket_.remote_endpoint(error);
+        if (error)
+        {
+            // The client went away before the session got to start.
+            socket_.close(error);
+            return;
+        }
+
+        // Keep the peer address, it can no longer be queried once the socket is closed.
+        remote_host_ = remote.address().to_string();
+        remote_port_ = remote.port();
+        id_ = next_session_id.fetch_add(1, std::memory_order_relaxed);
+        handle_ = SessionHandle(shared_from_this());
+
+        // The wheel only holds on to the deadlines weakly, and they only hold on to
+        // the session weakly, so neither keeps the other alive.
+        std::weak_ptr<TCP_Session> weak_self(shared_from_this());
+        auto on_expire = [weak_self]()
+        {
+            // The deadline has passed. Stop the session. The other actors will
+            // terminate as soon as possible.
+            if (auto self = weak_self.lock())
+            {
+                self->socket_server_->metrics_.timeouts.Add();
+                self->stop();
+            }
+        };
+        input_deadline_ = timing_wheel_.CreateEntry(on_expire);
+        output_deadline_ = timing_wheel_.CreateEntry(on_expire);
 
-        std::string chost = socket_.remote_endpoint().address().to_string();
-        unsigned short cport = socket_.remote_endpoint().port();
+        channel_.Join(shared_from_this());
+        socket_server_->register_session(shared_from_this());
 
-        socket_server_->OnClientConnected(chost, cport);
+        socket_server_->OnClientConnected(remote_host_, remote_port_);
 
         read_line();
-        check_deadline(input_deadline_);
-
-        await_output();
-        check_deadline(output_deadline_);
     }
 
     void TCP_Session::stop()
     {
+        if (stopped())
+            return;
+
         channel_.Leave(shared_from_this());
+        socket_server_->unregister_session(id_);
+        socket_server_->metrics_.disconnects.Add();
+
+        socket_server_->OnClientDisconnected(remote_host_, remote_port_);
 
-        std::string chost = socket_.remote_endpoint().address().to_string();
-        unsigned short cport = socket_.remote_endpoint().port();
+        boost::system::error_code ignored_error;
+        socket_.close(ignored_error);
+        timing_wheel_.Cancel(input_deadline_);
+        timing_wheel_.Cancel(output_deadline_);
+    }
 
-        socket_server_->OnClientDisconnected(chost, cport);
+    void TCP_Session::Close()
+    {
+        channel_.Leave(shared_from_this());
 
         boost::system::error_code ignored_error;
         socket_.close(ignored_error);
-        input_deadline_.cancel();
-        non_empty_output_queue_.cancel();
-        output_deadline_.cancel();
+        timing_wheel_.Cancel(input_deadline_);
+        timing_wheel_.Cancel(output_deadline_);
     }
 
     bool TCP_Session::stopped() const
@@ -64,27 +565,209 @@ namespace SPSocket
         return !socket_.is_open();
     }
 
-    void TCP_Session::deliver(const std::string& msg)
+    SessionStats TCP_Session::GetStats() const
     {
-        output_queue_.push_back(msg);
+        SessionStats stats;
+        stats.id = id_;
+        stats.host = remote_host_;
+        stats.port = remote_port_;
+        stats.bytes_in = bytes_in_.load(std::memory_order_relaxed);
+        stats.bytes_out = bytes_out_.load(std::memory_order_relaxed);
+        stats.msgs_in = msgs_in_.load(std::memory_order_relaxed);
+        stats.msgs_out = msgs_out_.load(std::memory_order_relaxed);
+        stats.queue_depth = queue_depth_.load(std::memory_order_relaxed);
+        stats.max_queue_depth = max_queue_depth_.load(std::memory_order_relaxed);
+        stats.queued_bytes = queued_bytes_.load(std::memory_order_relaxed);
+        stats.dropped = dropped_.load(std::memory_order_relaxed);
+        stats.conflated = conflated_.load(std::memory_order_relaxed);
+        stats.write_in_flight = write_in_flight_.load(std::memory_order_relaxed);
+        return stats;
+    }
 
-        // Signal that the output queue contains messages. Modifying the expiry
-        // will wake the output actor, if it is waiting on the timer.
-        non_empty_output_queue_.expires_at(steady_timer::time_point::min());
+    void TCP_Session::update_queue_depth()
+    {
+        std::uint64_t depth = output_queue_.size();
+        queue_depth_.store(depth, std::memory_order_relaxed);
+        queued_bytes_.store(output_bytes_, std::memory_order_relaxed);
+        if (depth > max_queue_depth_.load(std::memory_order_relaxed))
+            max_queue_depth_.store(depth, std::memory_order_relaxed);
     }
 
-    void TCP_Session::read_line()
+    void TCP_Session::deliver(const message_ptr& msg)
     {
-        // Set a deadline for the read operation.     
-        if (rw_timeout > 0)
+        // The caller may be on any thread. Only the first message into an empty
+        // inbox has to wake the session, the rest ride along with the same drain.
+        // The time stamp is for the deliver-to-wire latency.
+        if (inbox_.Push(delivery{ queued_message{ msg, std::chrono::steady_clock::now() }, nullptr }))
+            wake();
+    }
+
+    void TCP_Session::deliver(const std::vector<message_ptr>& msgs)
+    {
+        bool was_empty = false;
+        auto now = std::chrono::steady_clock::now();
+        for (const auto& msg : msgs)
+        {
+            if (inbox_.Push(delivery{ queued_message{ msg, now }, nullptr }))
+                was_empty = true;
+        }
+
+        if (was_empty)
+            wake();
+    }
+
+    void TCP_Session::deliver(const message_ptr& msg, const message_ptr& original)
+    {
+        if (inbox_.Push(delivery{ queued_message{ msg, std::chrono::steady_clock::now() }, original }))
+            wake();
+    }
+
+    void TCP_Session::wake()
+    {
+        // Only one drain is ever pending, the next is posted once it has emptied
+        // the inbox, so its handler always finds drain_memory_ free.
+        auto self(shared_from_this());
+        boost::asio::post(io_context_, MakeCustomAllocHandler(drain_memory_, [this, self]() { drain_inbox(); }));
+    }
+
+    void TCP_Session::drain_inbox()
+    {
+        if (stopped())
+        {
+            inbox_.Consume([](delivery&&) {});
+            return;
+        }
+
+        if (inbox_.Consume([this](delivery&& d) { enqueue(std::move(d.queued), d.original); }) > 0)
+        {
+            update_queue_depth();
+            kick_output();
+        }
+    }
+
+    void TCP_Session::enqueue(queued_message&& msg, const message_ptr& original)
+    {
+        // A disconnect policy may have stopped the session half way through a batch.
+        if (stopped())
+            return;
+
+        const std::size_t size = msg.msg->size();
+        std::string_view key;
+
+        if (overflow_policy == OverflowPolicy::O_CONFLATE && conflation_key)
+        {
+            key = conflation_key(payload_of(original ? *original : *msg.msg));
+            if (!key.empty() && conflate(key, msg))
+                return;
+        }
+
+        if (over_limit(size))
+        {
+            ServerMetrics& metrics = socket_server_->metrics_;
+            switch (overflow_policy)
+            {
+            case OverflowPolicy::O_DISCONNECT:
+                metrics.overflow_disconnects.Add();
+                stop();
+                return;
+
+            case OverflowPolicy::O_DROP_NEWEST:
+                metrics.dropped.Add();
+                BumpRelaxed(dropped_);
+                return;
+
+            case OverflowPolicy::O_DROP_OLDEST:
+            case OverflowPolicy::O_CONFLATE:
+                // Messages being written cannot be taken back, only those behind them.
+                // Nor can the answer to the request for compression, the client
+                // waits for it.
+                while (over_limit(size))
+                {
+                    auto oldest = output_queue_.begin() + in_flight();
+                    if (oldest != output_queue_.end() && compression_accepted_ && oldest->seq == compression_answer_seq_)
+                        ++oldest;
+                    if (oldest == output_queue_.end())
+                        break;
+
+                    output_bytes_ -= oldest->msg->size();
+                    output_queue_.rerase(oldest);
+                    metrics.dropped.Add();
+                    BumpRelaxed(dropped_);
+                }
+                break;
+            }
+        }
+
+        // Only a message with others waiting ahead of it can be conflated later on,
+        // the first into an idle queue goes straight out.
+        msg.seq = next_seq_++;
+        if (!key.empty() && (write_in_progress_ || !output_queue_.empty()))
         {
-            input_deadline_.expires_after(std::chrono::seconds(rw_timeout));
+            auto it = conflation_index_.find(key);
+            if (it != conflation_index_.end())
+                it->second = msg.seq;
+            else
+                conflation_index_.emplace(std::string(key), msg.seq);
         }
 
-        // Start an asynchronous operation to read a newline-delimited message.
+        output_bytes_ += size;
+        push_output(std::move(msg));
+    }
+
+    void TCP_Session::push_output(queued_message&& msg)
+    {
+        // Unlike a deque, the ring does not free and allocate blocks as messages
+        // pass through it, it only grows to the deepest the queue has been.
+        if (output_queue_.full())
+            output_queue_.set_capacity(std::max<std::size_t>(output_queue_.capacity() * 2, 16));
+        output_queue_.push_back(std::move(msg));
+    }
+
+    bool TCP_Session::conflate(std::string_view key, queued_message& msg)
+    {
+        auto it = conflation_index_.find(key);
+        if (it == conflation_index_.end())
+            return false;
+
+        // The index may be stale, the message it points at must still be waiting.
+        auto queued = std::lower_bound(output_queue_.begin() + in_flight(), output_queue_.end(), it->second,
+            [](const queued_message& m, std::uint64_t seq) { return m.seq < seq; });
+        if (queued == output_queue_.end() || queued->seq != it->second)
+            return false;
+
+        // Keep the place in the queue, send the latest value.
+        output_bytes_ = output_bytes_ - queued->msg->size() + msg.msg->size();
+        queued->msg = std::move(msg.msg);
+        queued->enqueued = msg.enqueued;
+
+        socket_server_->metrics_.conflated.Add();
+        BumpRelaxed(conflated_);
+        return true;
+    }
+
+    bool TCP_Session::over_limit(std::size_t extra_bytes) const
+    {
+        return (queue_max_msgs > 0 && output_queue_.size() + 1 > queue_max_msgs) ||
+            (queue_max_bytes > 0 && output_bytes_ + extra_bytes > queue_max_bytes);
+    }
+
+    std::string_view TCP_Session::payload_of(const std::string& msg) const
+    {
+        std::string_view payload(msg);
+        if (codec_.Mode() == FramingMode::F_LENGTH_PREFIX)
+            payload.remove_prefix(std::min(codec_.HeaderWidth(), payload.size()));
+        return payload;
+    }
+
+    void TCP_Session::read_line()
+    {
+        // Set a deadline for the read operation.
+        arm_deadline(input_deadline_);
+
+        // Read whatever is available into the free space of the receive buffer,
+        // the messages are cut out of it afterwards.
         auto self(shared_from_this());
-        boost::asio::async_read_until(socket_,
-            boost::asio::dynamic_buffer(input_buffer_), read_terminator,
+        socket_.async_read_some(frame_reader_.Prepare(), MakeCustomAllocHandler(read_memory_,
             [this, self](const boost::system::error_code& error, std::size_t n)
         {
             // Check if the session was stopped while the operation was pending.
@@ -93,31 +776,66 @@ namespace SPSocket
 
             if (!error)
             {
-                // Extract the delimited message from the buffer.
-                std::string str_recv(input_buffer_.substr(0, n - 1));
-                input_buffer_.erase(0, n);
+                frame_reader_.Commit(n);
 
-                if (!str_recv.empty())
-                {
-                    socket_server_->OnReceive(str_recv);
+                // Cut every complete message out of the buffer in one pass, then hand
+                // them out as views straight into the receive buffer. Nothing is copied
+                // or allocated per message, and the next read is only started once no
+                // complete message is left.
+                frames_.clear();
+                FrameStatus status = frame_reader_.NextBatch(codec_, frames_);
 
-                    // Send data to connecting client only
-                    //Send(str_recv);
-                }
-                else
+                ServerMetrics& metrics = socket_server_->metrics_;
+                metrics.reads.Add();
+                metrics.bytes_in.Add(n);
+                metrics.frames_per_read.Record(frames_.size());
+                BumpRelaxed(bytes_in_, n);
+
+                // Heartbeats and requests for compression are answered here and
+                // dropped from the batch. Clients never send compressed messages.
+                std::size_t count = 0;
+                std::size_t heartbeats = 0;
+                bool compressed = false;
+                for (const auto& frame : frames_)
                 {
-                    // We received a heartbeat message from the client. If there's
-                    // nothing else being sent or ready to be sent, send a heartbeat
-                    // right back.
-                    if (output_queue_.empty())
+                    if (codec_.IsCompressed(frame.data()))
                     {
-                        output_queue_.push_back("HB" + read_terminator);
-
-                        // Signal that the output queue contains messages. Modifying
-                        // the expiry will wake the output actor, if it is waiting on
-                        // the timer.
-                        non_empty_output_queue_.expires_at(steady_timer::time_point::min());
+                        std::uint32_t dictionary_id = 0;
+                        if (DecodeDictionaryId(frame, dictionary_id))
+                            answer_compression(dictionary_id);
+                        else
+                            compressed = true;
                     }
+                    else if (!frame.empty())
+                        frames_[count++] = frame;
+                    else
+                    {
+                        ++heartbeats;
+                        reply_heartbeat();
+                    }
+                }
+                if (heartbeats > 0)
+                    metrics.heartbeats.Add(heartbeats);
+                frames_.resize(count);
+
+                metrics.msgs_in.Add(count);
+                BumpRelaxed(msgs_in_, count);
+
+                // Reply to this client only with session.Send() from the callback.
+                if (!frames_.empty())
+                    socket_server_->OnReceiveBatch(handle_, frames_);
+
+                if (status == FrameStatus::F_OVERSIZED)
+                {
+                    socket_server_->OnReceiveError("message exceeds the maximum frame size");
+                    stop();
+                    return;
+                }
+                if (compressed)
+                {
+                    socket_server_->OnReceiveError("compressed message from client");
+                    stop();
+                    return;
                 }
                 read_line();
             }
@@ -126,142 +844,608 @@ namespace SPSocket
                 socket_server_->OnReceiveError(error.message());
                 stop();
             }
-        });
+        }));
     }
 
-    void TCP_Session::await_output()
+    void TCP_Session::reply_heartbeat()
     {
-        auto self(shared_from_this());
-        non_empty_output_queue_.async_wait(
-            [this, self](const boost::system::error_code& /*error*/)
+        // We received a heartbeat message from the client. If there's nothing
+        // else being sent or ready to be sent, send a heartbeat right back.
+        if (output_queue_.empty())
         {
-            // Check if the session was stopped while the operation was pending.
-            if (stopped())
-                return;
+            message_ptr heartbeat = codec_.Mode() == FramingMode::F_LENGTH_PREFIX
+                ? MakeMessage(codec_.Encode(std::string()))
+                : MakeMessage(std::string("HB") + read_terminator);
+            push_output(queued_message{ heartbeat, std::chrono::steady_clock::now(), next_seq_++ });
+            output_bytes_ += heartbeat->size();
 
-            if (output_queue_.empty())
-            {
-                // There are no messages that are ready to be sent. The actor goes
-                // to sleep by waiting on the non_empty_output_queue_ timer. When a
-                // new message is added, the timer will be modified and the actor
-                // will wake.
-                non_empty_output_queue_.expires_at(steady_timer::time_point::max());
-                await_output();
-            }
-            else
-            {
-                write_line();
-            }
-        });
+            kick_output();
+        }
+    }
+
+    void TCP_Session::answer_compression(std::uint32_t dictionary_id)
+    {
+        // A refusal names the server's own dictionary, or 0 without compression.
+        // An acceptance only takes effect once it is on its way to the client,
+        // see write_line(), so no compressed message can overtake it.
+        const std::uint32_t own_id = socket_server_->dictionary_id_;
+        const bool accept = own_id != 0 && dictionary_id == own_id;
+
+        std::string answer(codec_.HeaderWidth(), '\0');
+        if (accept)
+            codec_.EncodeHeader(0, &answer[0], true);
+        else
+            answer = EncodeDictionaryId(codec_, own_id);
+
+        message_ptr msg = MakeMessage(std::move(answer));
+        output_bytes_ += msg->size();
+        if (accept)
+        {
+            compression_accepted_ = true;
+            compression_answer_seq_ = next_seq_;
+        }
+        else
+            socket_server_->metrics_.compression_refused.Add();
+        push_output(queued_message{ msg, std::chrono::steady_clock::now(), next_seq_++ });
+
+        kick_output();
+    }
+
+    void TCP_Session::kick_output()
+    {
+        // Start the output actor right away unless a write is already in flight,
+        // its completion handler picks up whatever has been queued meanwhile.
+        if (!write_in_progress_ && !output_queue_.empty())
+            write_line();
     }
 
     void TCP_Session::write_line()
     {
         // Set a deadline for the write operation.
-        if (rw_timeout > 0)
+        arm_deadline(output_deadline_);
+
+        // Gather as many queued messages as the limits allow, always at least one.
+        // The messages stay in the queue, and so alive, until the write completes.
+        write_buffers_.clear();
+        std::size_t write_bytes = 0;
+        for (const auto& queued : output_queue_)
         {
-            output_deadline_.expires_after(std::chrono::seconds(rw_timeout));
+            const std::string& msg = *queued.msg;
+            if (!write_buffers_.empty() &&
+                (write_buffers_.size() >= write_max_buffers || write_bytes + msg.size() > write_max_bytes))
+                break;
+
+            write_buffers_.push_back(boost::asio::buffer(msg));
+            write_bytes += msg.size();
+
+            // Everything delivered from now on is queued behind this write.
+            if (compression_accepted_ && queued.seq == compression_answer_seq_)
+            {
+                compression_accepted_ = false;
+                if (channel_.UseCompressedDelivery(shared_from_this(), true))
+                    socket_server_->metrics_.compressed_sessions.Add();
+            }
         }
 
-        // Start an asynchronous operation to send a message.
+        // Start an asynchronous operation to send the gathered messages.
+        write_in_progress_ = true;
+        write_in_flight_.store(true, std::memory_order_relaxed);
+        write_started_ = std::chrono::steady_clock::now();
         auto self(shared_from_this());
-        boost::asio::async_write(socket_,
-            boost::asio::buffer(output_queue_.front()),
-            [this, self](const boost::system::error_code& error, std::size_t /*n*/)
+        boost::asio::async_write(socket_, buffer_view{ write_buffers_.data(), write_buffers_.data() + write_buffers_.size() },
+            MakeCustomAllocHandler(write_memory_,
+            [this, self](const boost::system::error_code& error, std::size_t n)
         {
             // Check if the session was stopped while the operation was pending.
             if (stopped())
                 return;
 
+            write_in_progress_ = false;
+            write_in_flight_.store(false, std::memory_order_relaxed);
+
             if (!error)
             {
-                output_queue_.pop_front();
-                await_output();
+                auto now = std::chrono::steady_clock::now();
+                auto written = output_queue_.begin() + write_buffers_.size();
+
+                ServerMetrics& metrics = socket_server_->metrics_;
+                metrics.writes.Add();
+                metrics.bytes_out.Add(n);
+                metrics.msgs_out.Add(write_buffers_.size());
+                metrics.write_time.Record(now - write_started_);
+                for (auto it = output_queue_.begin(); it != written; ++it)
+                    metrics.deliver_to_wire.Record(now - it->enqueued);
+                BumpRelaxed(bytes_out_, n);
+                BumpRelaxed(msgs_out_, write_buffers_.size());
+
+                output_queue_.erase_begin(write_buffers_.size());
+                output_bytes_ -= n;
+                update_queue_depth();
+
+                if (!output_queue_.empty())
+                {
+                    write_line();
+                }
+                else
+                {
+                    // Nothing left to send, so there is no write deadline to enforce
+                    // and nothing left to conflate with.
+                    timing_wheel_.Cancel(output_deadline_);
+                    conflation_index_.clear();
+                }
             }
             else
             {
                 stop();
             }
-        });
+        }));
+    }
+
+    void TCP_Session::arm_deadline(const TimingWheel::entry_ptr& deadline)
+    {
+        // No timeout configured means no deadline at all.
+        if (rw_timeout > 0)
+            timing_wheel_.ExpiresAfter(deadline, std::chrono::seconds(rw_timeout));
+    }
+
+    //----------------------------------------------------------------------
+
+#if defined(__linux__)
+    struct UDP_Broadcaster::batch {
+        mmsghdr msgs[max_batch];
+        iovec iov[max_batch][2];
+    };
+#else
+    struct UDP_Broadcaster::batch {};
+#endif
+
+    UDP_Broadcaster::UDP_Broadcaster(boost::asio::io_context& io_context,
+        const udp::endpoint& broadcast_endpoint)
+        : io_context_(io_context), socket_(io_context), batch_(new batch())
+    {
+        socket_.open(broadcast_endpoint.protocol());
+        socket_.set_option(udp::socket::broadcast(true));
+        socket_.non_blocking(true);
+        endpoints_.push_back(broadcast_endpoint);
+    }
+
+    UDP_Broadcaster::~UDP_Broadcaster() noexcept
+    {
+    }
+
+    void UDP_Broadcaster::AddEndpoint(const udp::endpoint& endpoint)
+    {
+        if (endpoint.protocol() != endpoints_.front().protocol())
+            throw std::invalid_argument("broadcast endpoints must all be IPv4 or all IPv6");
+        endpoints_.push_back(endpoint);
+    }
+
+    void UDP_Broadcaster::UseMulticastHops(int hops)
+    {
+        socket_.set_option(boost::asio::ip::multicast::hops(hops));
+    }
+
+    void UDP_Broadcaster::deliver(const message_ptr& msg)
+    {
+        // Called from whichever thread delivers, the first message into an empty
+        // inbox schedules the flush.
+        if (inbox_.Push(msg))
+        {
+            auto self(shared_from_this());
+            boost::asio::post(io_context_, [this, self]() { flush(); });
+        }
+    }
+
+    void UDP_Broadcaster::deliver(const std::vector<message_ptr>& msgs)
+    {
+        bool wake = false;
+        for (const auto& msg : msgs)
+        {
+            if (inbox_.Push(msg))
+                wake = true;
+        }
+
+        if (wake)
+        {
+            auto self(shared_from_this());
+            boost::asio::post(io_context_, [this, self]() { flush(); });
+        }
+    }
+
+    void UDP_Broadcaster::flush()
+    {
+        inbox_.Consume([this](message_ptr&& msg) { pending_.push_back(pending_message{ std::move(msg), next_seq_++ }); });
+
+        // Nobody is reading fast enough for what is left, keep the latest.
+        while (pending_.size() > max_pending)
+        {
+            datagram_errors.Add(endpoints_.size() - next_endpoint_);
+            pending_.pop_front();
+            next_endpoint_ = 0;
+        }
+
+        if (!sending_)
+            send_pending();
+    }
+
+    void UDP_Broadcaster::advance(std::size_t count)
+    {
+        next_endpoint_ += count;
+        while (!pending_.empty() && next_endpoint_ >= endpoints_.size())
+        {
+            next_endpoint_ -= endpoints_.size();
+            pending_.pop_front();
+        }
     }
 
-    void TCP_Session::check_deadline(steady_timer& deadline)
+#if defined(__linux__)
+    void UDP_Broadcaster::send_pending()
     {
+        while (!pending_.empty())
+        {
+            // Lay out the next datagrams, as many as fit into one call.
+            unsigned int count = 0;
+            std::size_t endpoint = next_endpoint_;
+            for (auto it = pending_.begin(); it != pending_.end() && count < max_batch; ++it, endpoint = 0)
+            {
+                for (; endpoint < endpoints_.size() && count < max_batch; ++endpoint, ++count)
+                {
+                    iovec* iov = batch_->iov[count];
+                    std::size_t iov_count = 0;
+                    if (sequence_header_)
+                    {
+                        EncodeSequence(it->seq, headers_[count]);
+                        iov[iov_count++] = iovec{ headers_[count], SEQUENCE_HEADER_SIZE };
+                    }
+                    iov[iov_count++] = iovec{ const_cast<char*>(it->msg->data()), it->msg->size() };
+
+                    msghdr& hdr = batch_->msgs[count].msg_hdr;
+                    hdr = msghdr();
+                    hdr.msg_name = const_cast<void*>(static_cast<const void*>(endpoints_[endpoint].data()));
+                    hdr.msg_namelen = static_cast<socklen_t>(endpoints_[endpoint].size());
+                    hdr.msg_iov = iov;
+                    hdr.msg_iovlen = iov_count;
+                }
+            }
+
+            int sent = ::sendmmsg(socket_.native_handle(), batch_->msgs, count, MSG_DONTWAIT);
+            if (sent < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+                {
+                    // The send buffer is full, carry on once there is room again.
+                    sending_ = true;
+                    auto self(shared_from_this());
+                    socket_.async_wait(udp::socket::wait_write, MakeCustomAllocHandler(send_memory_,
+                        [this, self](boost::system::error_code ec)
+                    {
+                        sending_ = false;
+                        if (!ec)
+                            flush();
+                    }));
+                    return;
+                }
+
+                // The first datagram cannot be sent at all, e.g. no route to its endpoint.
+                datagram_errors.Add();
+                advance(1);
+                continue;
+            }
+
+            datagrams.Add(sent);
+            datagrams_per_send.Record(static_cast<std::uint64_t>(sent));
+            advance(static_cast<std::size_t>(sent));
+        }
+    }
+#else
+    void UDP_Broadcaster::send_pending()
+    {
+        if (pending_.empty())
+            return;
+
+        const pending_message& front = pending_.front();
+        if (sequence_header_)
+            EncodeSequence(front.seq, headers_[0]);
+
+        std::array<boost::asio::const_buffer, 2> buffers = {
+            boost::asio::buffer(headers_[0], sequence_header_ ? SEQUENCE_HEADER_SIZE : 0),
+            boost::asio::buffer(*front.msg)
+        };
+
+        sending_ = true;
         auto self(shared_from_this());
-        deadline.async_wait(
-            [this, self, &deadline](const boost::system::error_code& /*error*/)
+        socket_.async_send_to(buffers, endpoints_[next_endpoint_], MakeCustomAllocHandler(send_memory_,
+            [this, self](boost::system::error_code ec, std::size_t /*n*/)
         {
-            // Check if the session was stopped while the operation was pending.
-            if (stopped())
+            sending_ = false;
+            if (ec == boost::asio::error::operation_aborted)
                 return;
 
-            // Check whether the deadline has passed. We compare the deadline
-            // against the current time since a new asynchronous operation may
-            // have moved the deadline before this actor had a chance to run.
-            if (deadline.expiry() <= steady_timer::clock_type::now())
+            if (ec)
             {
-                // The deadline has passed. Stop the session. The other actors will
-                // terminate as soon as possible.
-                stop();
+                datagram_errors.Add();
             }
             else
             {
-                // Put the actor back to sleep.
-                check_deadline(deadline);
+                datagrams.Add();
+                datagrams_per_send.Record(1);
             }
-        });
+            advance(1);
+            flush();
+        }));
     }
+#endif
 
     //----------------------------------------------------------------------
 
-    UDP_Broadcaster::UDP_Broadcaster(boost::asio::io_context& io_context,
+    SPSocketServer::SPSocketServer(boost::asio::io_context& io_context,
+        const tcp::endpoint& listen_endpoint,
         const udp::endpoint& broadcast_endpoint)
-        : socket_(io_context)
+        : io_context_(io_context),
+        acceptor_(io_context, listen_endpoint),
+        drain_guard_(std::make_shared<drain_guard>())
     {
-        socket_.connect(broadcast_endpoint);
-        socket_.set_option(udp::socket::broadcast(true));
+        drain_guard_->server = this;
+        broadcaster_ = std::make_shared<UDP_Broadcaster>(io_context_, broadcast_endpoint);
+        channel_.Join(broadcaster_);
     }
 
-    void UDP_Broadcaster::deliver(const std::string& msg)
+    SPSocketServer::~SPSocketServer() noexcept
     {
+        // A drain still queued on the acceptor's io_context finds the server gone,
+        // one running now finishes first. What it has not taken is dropped.
+        {
+            std::lock_guard<std::mutex> lock(drain_guard_->mtx);
+            drain_guard_->server = nullptr;
+        }
+        broadcast_queue_.Consume([](message_ptr&&) {});
+
+        if (io_context_pool_)
+        {
+            // No session handler runs from here on.
+            io_context_pool_->Stop();
+
+            // Close the connections now, the sessions themselves go with the pool.
+            std::map<std::uint64_t, std::weak_ptr<TCP_Session>> sessions;
+            {
+                std::lock_guard<std::mutex> lock(sessions_mtx_);
+                sessions.swap(sessions_);
+            }
+            for (const auto& s : sessions)
+            {
+                if (tcp_session_ptr session = s.second.lock())
+                    session->Close();
+            }
+        }
+
+        // The aborted accept is queued on the acceptor's io_context with a socket
+        // of the pool's. The pool goes with a handler queued behind it, so it is
+        // destroyed after the accept, whether that io_context runs them or not.
         boost::system::error_code ignored_error;
-        socket_.send(boost::asio::buffer(msg), 0, ignored_error);
+        acceptor_.close(ignored_error);
+        if (io_context_pool_)
+        {
+            std::shared_ptr<IOContextPool> pool(std::move(io_context_pool_));
+            boost::asio::post(io_context_, [pool]() {});
+        }
     }
 
-    //----------------------------------------------------------------------
+    void SPSocketServer::UseIOContextPool(std::size_t pool_size, bool pin_threads)
+    {
+        io_context_pool_.reset(new IOContextPool(pool_size > 0 ? pool_size : 1, pin_threads));
+    }
 
-    SPSocketServer::SPSocketServer(boost::asio::io_context& io_context,
-        const tcp::endpoint& listen_endpoint,
-        const udp::endpoint& broadcast_endpoint)
-        : io_context_(io_context),
-        acceptor_(io_context, listen_endpoint)
+    void SPSocketServer::StartServer()
     {
-        channel_.Join(std::make_shared<UDP_Broadcaster>(io_context_, broadcast_endpoint));        
+        if (io_context_pool_)
+            io_context_pool_->Run();
+
+        OnServerStarted();
+        accept();
     }
 
     void SPSocketServer::accept()
     {
-        acceptor_.async_accept(
-            [this](const boost::system::error_code& error, tcp::socket socket)
+        // Without a pool the new socket lives on the acceptor's io_context.
+        boost::asio::io_context& session_context =
+            io_context_pool_ ? io_context_pool_->GetIOContext() : io_context_;
+
+        // No handler memory of the server's, the aborted accept may complete after
+        // the server is gone (see ~SPSocketServer). Asio recycles it per thread.
+        acceptor_.async_accept(session_context,
+            [this, &session_context](const boost::system::error_code& error, tcp::socket socket)
         {
+            if (error == boost::asio::error::operation_aborted)
+                return;
+
             if (!error)
             {
-                auto tcp_ptr = std::make_shared<TCP_Session>(std::move(socket), channel_, this);
-                tcp_ptr->UseReadUntil(read_terminator);
-                tcp_ptr->UseReadWriteTimeOut(read_write_timeout);
-                tcp_ptr->Start();
+                metrics_.accepts.Add();
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                if (session_coroutine_)
+                    boost::asio::co_spawn(session_context, run_session(CoSession(std::move(socket), codec_)), boost::asio::detached);
+                else
+#endif
+                    start_session(session_context, std::move(socket));
+            }
+            else
+            {
+                metrics_.accept_errors.Add();
+            }
+            if (acceptor_.is_open())
+                accept();
+        });
+    }
+
+    void SPSocketServer::start_session(boost::asio::io_context& session_context, tcp::socket socket)
+    {
+        // Sessions, together with their shared_ptr control block, come from
+        // a slab pool per io_context, so a wave of connects and disconnects
+        // mostly recycles memory instead of going to the global allocator.
+        std::shared_ptr<SlabPool>& pool = session_pools_[&session_context];
+        if (!pool)
+            pool = std::make_shared<SlabPool>();
+
+        auto tcp_ptr = std::allocate_shared<TCP_Session>(SlabAllocator<TCP_Session>(pool),
+            session_context, std::move(socket), channel_, this);
+        tcp_ptr->UseReadUntil(read_terminator);
+        tcp_ptr->UseFraming(codec_);
+        tcp_ptr->UseReadWriteTimeOut(read_write_timeout);
+        tcp_ptr->UseWriteCoalescing(write_max_bytes, write_max_buffers);
+        tcp_ptr->UseOutputQueueLimit(queue_max_bytes, queue_max_msgs, overflow_policy);
+        tcp_ptr->UseConflationKey(conflation_key);
+
+        // Start the actors on the session's own io_context thread.
+        boost::asio::post(tcp_ptr->GetExecutor(), [tcp_ptr]() { tcp_ptr->Start(); });
+    }
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+    awaitable<void> SPSocketServer::run_session(CoSession session)
+    {
+        const std::string host = session.RemoteHost();
+        const unsigned short port = session.RemotePort();
+        OnClientConnected(host, port);
+
+        try
+        {
+            co_await session_coroutine_(std::move(session));
+        }
+        catch (const boost::system::system_error& e)
+        {
+            if (e.code() != boost::asio::error::eof &&
+                e.code() != boost::asio::error::connection_reset &&
+                e.code() != boost::asio::error::operation_aborted)
+            {
+                OnReceiveError(e.what());
             }
-            accept();
+        }
+        catch (const std::exception& e)
+        {
+            OnReceiveError(e.what());
+        }
+
+        metrics_.disconnects.Add();
+        OnClientDisconnected(host, port);
+    }
+#endif
+
+    void SPSocketServer::UseLastValueCache(const ConflationKey& key)
+    {
+        conflation_key = key;
+
+        // The channel sees messages with their length header, the key does not.
+        channel_.UseLastValueCache([this](std::string_view msg)
+        {
+            if (codec_.Mode() == FramingMode::F_LENGTH_PREFIX)
+                msg.remove_prefix(std::min(codec_.HeaderWidth(), msg.size()));
+            return conflation_key(msg);
         });
     }
 
+    void SPSocketServer::UseLengthPrefix(std::size_t header_width, ByteOrder order)
+    {
+        // The flag is decoded even without compression, so a client asking for it
+        // is refused rather than dropped for an oversized frame.
+        codec_.UseLengthPrefix(header_width, order);
+        if (header_width == 4)
+            codec_.UseCompressionFlag(true);
+    }
+
+    void SPSocketServer::UseCompression(const std::string& dictionary, int level)
+    {
+        codec_.UseCompressionFlag(true);
+        compressor_ = std::make_shared<const FrameCompressor>(codec_, dictionary, level);
+        dictionary_id_ = DictionaryId(dictionary);
+        channel_.UseCompression(compressor_);
+    }
+
+    void SPSocketServer::BroadCast(const message_ptr& msg)
+    {
+        // Only the producer that finds the queue empty posts, everything pushed
+        // until the drain runs is delivered in the same batch.
+        if (broadcast_queue_.Push(msg))
+        {
+            std::shared_ptr<drain_guard> guard(drain_guard_);
+            boost::asio::post(io_context_, [guard]()
+            {
+                std::lock_guard<std::mutex> lock(guard->mtx);
+                if (guard->server)
+                    guard->server->drain_broadcasts();
+            });
+        }
+    }
+
+    void SPSocketServer::drain_broadcasts()
+    {
+        broadcast_queue_.Consume([this](message_ptr&& msg) { broadcast_batch_.push_back(std::move(msg)); });
+
+        if (!broadcast_batch_.empty())
+        {
+            channel_.Deliver(broadcast_batch_);
+            broadcast_batch_.clear();
+        }
+    }
+
+    ServerMetricsSnapshot SPSocketServer::GetMetrics() const
+    {
+        ServerMetricsSnapshot snapshot = metrics_.Snapshot();
+        snapshot.datagrams = broadcaster_->datagrams.Load();
+        snapshot.datagram_errors = broadcaster_->datagram_errors.Load();
+        snapshot.datagrams_per_send = broadcaster_->datagrams_per_send.Snapshot();
+        if (compressor_)
+        {
+            snapshot.compressed = compressor_->frames.Load();
+            snapshot.compress_bytes_in = compressor_->bytes_in.Load();
+            snapshot.compress_bytes_out = compressor_->bytes_out.Load();
+        }
+
+        std::lock_guard<std::mutex> lock(sessions_mtx_);
+        snapshot.sessions.reserve(sessions_.size());
+        for (const auto& entry : sessions_)
+        {
+            if (tcp_session_ptr session = entry.second.lock())
+                snapshot.sessions.push_back(session->GetStats());
+        }
+        return snapshot;
+    }
+
+    void SPSocketServer::register_session(const tcp_session_ptr& session)
+    {
+        std::lock_guard<std::mutex> lock(sessions_mtx_);
+        sessions_[session->GetId()] = session;
+    }
+
+    void SPSocketServer::unregister_session(std::uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(sessions_mtx_);
+        sessions_.erase(id);
+    }
+
     void SPSocketServer::StopServer()
     {
+        // Closed right away, whatever the thread. Posted to the acceptor's
+        // io_context it would never run if that is stopped next, and the port
+        // would keep accepting after OnServerStopped().
         if (acceptor_.is_open())
         {
-            acceptor_.cancel();
-            acceptor_.close();
+            boost::system::error_code ignored_error;
+            acceptor_.cancel(ignored_error);
+            acceptor_.close(ignored_error);
+        }
+
+        // Joining the pool is left to the destructor, this may run on one of its threads.
+        std::map<std::uint64_t, std::weak_ptr<TCP_Session>> sessions;
+        {
+            std::lock_guard<std::mutex> lock(sessions_mtx_);
+            sessions = sessions_;
         }
+        for (const auto& s : sessions)
+        {
+            if (tcp_session_ptr session = s.second.lock())
+                boost::asio::post(session->GetExecutor(), [session]() { session->Stop(); });
+        }
+
         OnServerStopped();
     }
 }
\ No newline at end of file
@@ -4,19 +4,41 @@
 
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/multicast.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/udp.hpp>
-#include <boost/asio/read_until.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/write.hpp>
+#include <boost/circular_buffer.hpp>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
 #include <cstdlib>
 #include <deque>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "SPSocketAllocator.h"
+#include "SPSocketCompression.h"
+#include "SPSocketCoroutine.h"
+#include "SPSocketFraming.h"
+#include "SPSocketIOContextPool.h"
+#include "SPSocketMetrics.h"
+#include "SPSocketMPSCQueue.h"
+#include "SPSocketTimingWheel.h"
 
 // https://www.boost.org/doc/libs/1_78_0/doc/html/boost_asio/example/cpp11/timeouts/server.cpp
 // https://dens.website/tutorials/cpp-asio/async-tcp-server
@@ -29,63 +51,213 @@ namespace SPSocket
 
     //----------------------------------------------------------------------
 
+    // Messages are immutable once created and shared by reference count, so a
+    // broadcast is allocated once no matter how many subscribers queue it.
+    typedef std::shared_ptr<const std::string> message_ptr;
+
+    inline message_ptr MakeMessage(const std::string& msg) { return std::make_shared<const std::string>(msg); }
+    inline message_ptr MakeMessage(std::string&& msg) { return std::make_shared<const std::string>(std::move(msg)); }
+
+    // What a session does when a message would take its output queue over the
+    // limits set with UseOutputQueueLimit(), i.e. when the client does not keep up
+    enum class OverflowPolicy
+    {
+        O_DISCONNECT,       // drop the client
+        O_DROP_OLDEST,      // make room by discarding the oldest messages not yet being written
+        O_DROP_NEWEST,      // discard the new message
+        O_CONFLATE          // replace the queued message with the same key, else drop oldest
+    };
+
+    // Returns the conflation key of a message payload (without length header), or
+    // an empty view if the message must not be conflated. The view must point into
+    // the payload.
+    typedef std::function<std::string_view(std::string_view payload)> ConflationKey;
+
     class Subscriber {
     public:
         virtual ~Subscriber() = default;
-        virtual void deliver(const std::string& msg) = 0;
+        virtual void deliver(const message_ptr& msg) = 0;
+
+        // Subscribers that can take a whole batch more cheaply should override this
+        virtual void deliver(const std::vector<message_ptr>& msgs)
+        {
+            for (const auto& msg : msgs)
+                deliver(msg);
+        }
+
+        // Subscribers taking compressed delivery get the message to send next to
+        // the one it was compressed from, which may be the same
+        virtual void deliver(const message_ptr& msg, const message_ptr&) { deliver(msg); }
     };
 
     typedef std::shared_ptr<Subscriber> subscriber_ptr;
 
     //----------------------------------------------------------------------
 
+    // Sessions may run on different threads when the server uses an io_context
+    // pool. Joins, leaves and subscriptions are serialized by a mutex and publish a
+    // new routing table. Deliveries load the current table and iterate it without
+    // taking any lock, so they never wait for a join and a publish only costs as
+    // much as the topic has subscribers. Each subscriber is responsible for moving
+    // the message onto its own thread.
+    //
+    //   table: blocks   [ s0 | s1 | -- | s3 ] [ s64 | ... ]    slot per subscriber, reused
+    //          topics   "EURUSD" -> [0, 3]                  sorted slot numbers
+    //                   "USDJPY" -> [1, 3, 64]
+    //
+    // The new table shares every part the change leaves alone. A join or leave
+    // copies the block of its slot (64 subscribers) and the list of blocks, i.e.
+    // one pointer per 64 subscribers, and a leave also the topic map if the
+    // subscriber had any topics. A subscription copies the topic map and the
+    // slot list of its topic, the other topics' lists are shared. So a change is
+    // still linear in the number of subscribers or topics, but at a small
+    // fraction of copying the whole table, e.g. 220 pointers rather than 10000
+    // for a join next to 10000 subscribers.
+    //
+    // With a last-value cache the channel also keeps the latest message per key,
+    // e.g. per instrument. A subscriber joining late gets all of them as one batch
+    // before any further update, so it starts from a complete picture. The cache
+    // covers the messages delivered to everyone, not those published to a topic.
+    // Deliveries update it without a lock and never wait for a join: keys are
+    // only ever added, by a CAS on the list of their hash bucket, and a key's
+    // latest message is swapped in atomically. A join publishes the table first
+    // and then takes the snapshot, so a message cached too late for the snapshot
+    // is delivered live. The snapshot is taken outside the writers' mutex, so a
+    // large cache does not hold up other joins and leaves. The joiner then checks
+    // the keys it sent again and sends those that changed meanwhile, at most
+    // twice, so the last message it gets per key is not older than the one a
+    // delivery racing with it sent unless that delivery outlasts both passes.
+    // On the way a key may arrive twice, or an older message just before the
+    // current one, and the batches may interleave with live messages.
+    //
+    // With a compressor, subscribers that asked for it get their messages
+    // compressed. Each message is compressed once, by the delivering thread and
+    // only if the table has such a subscriber, and the copy is shared by all of
+    // them. The others get the original.
     class Channel {
     public:
-        void Join(subscriber_ptr subscriber)
-        {
-            subscribers_.insert(subscriber);
-        }
 
-        void Leave(subscriber_ptr subscriber)
-        {
-            subscribers_.erase(subscriber);
-        }
+        // Key of a message as delivered (i.e. encoded), empty = not cached
+        typedef std::function<std::string_view(std::string_view msg)> MessageKey;
 
-        void Deliver(const std::string& msg)
-        {
-            for (const auto& s : subscribers_)
-            {
-                s->deliver(msg);
-            }
-        }
+        Channel();
+        ~Channel() noexcept;
+
+        Channel(const Channel&) = delete;
+        Channel& operator=(const Channel&) = delete;
+
+        // Must be called before anyone joins or anything is delivered
+        void UseLastValueCache(const MessageKey& key);
+        void UseCompression(const std::shared_ptr<const FrameCompressor>& compressor) { compressor_ = compressor; }
+
+        // Switches a subscriber to compressed messages or back, false if it has not joined
+        bool UseCompressedDelivery(const subscriber_ptr& subscriber, bool enable);
+
+        void Join(subscriber_ptr subscriber);
+        void Leave(subscriber_ptr subscriber);
+
+        // Returns false if the subscriber has not joined (or already left)
+        bool Subscribe(const subscriber_ptr& subscriber, const std::string& topic);
+        bool Unsubscribe(const subscriber_ptr& subscriber, const std::string& topic);
+
+        // To every subscriber
+        void Deliver(const std::string& msg) { Deliver(MakeMessage(msg)); }
+        void Deliver(const message_ptr& msg);
+        void Deliver(const std::vector<message_ptr>& msgs);
+
+        // To the subscribers of the topic only
+        void Publish(std::string_view topic, const message_ptr& msg);
+
+        std::size_t LastValueCount() const { return cache_count_.load(std::memory_order_relaxed); }
+        std::size_t SubscriberCount(std::string_view topic);
 
     private:
-        std::set<subscriber_ptr> subscribers_;
+
+        static constexpr std::uint32_t block_size = 64;
+
+        struct slot_block {
+            subscriber_ptr subscribers[block_size];
+            std::bitset<block_size> compressed;     // UseCompressedDelivery()
+        };
+
+        typedef std::vector<std::uint32_t> slot_list;
+        typedef std::vector<std::shared_ptr<const slot_block>> block_list;
+        typedef std::map<std::string, std::shared_ptr<const slot_list>, std::less<>> topic_map;
+
+        // Never modified once published, nor is anything it points to
+        struct routing_table {
+            std::shared_ptr<const block_list> blocks;
+            std::shared_ptr<const topic_map> topics;
+            std::size_t compressed_count = 0;
+
+            const slot_block& block_of(std::uint32_t slot) const { return *(*blocks)[slot / block_size]; }
+        };
+
+        typedef std::shared_ptr<const routing_table> table_ptr;
+
+        // A writer's joined subscriber
+        struct member {
+            std::uint32_t slot;
+            std::size_t topics;
+        };
+
+        static constexpr std::size_t cache_buckets = 1024;
+        static constexpr int cache_rechecks = 2;        // deliver_cache() passes after the snapshot
+
+        // Never removed, only value changes, by std::atomic_store
+        struct cached_value {
+            std::string key;
+            message_ptr value;
+            cached_value* next;
+        };
+
+        table_ptr load_table() const { return std::atomic_load(&table_); }
+        table_ptr load_table_and_cache(const message_ptr* msgs, std::size_t count);
+        void cache(const message_ptr& msg);
+        void deliver_cache(const subscriber_ptr& subscriber);
+        message_ptr compress(const message_ptr& msg) const;
+        void clear_cache();
+        static slot_block& copy_block(routing_table& table, std::uint32_t slot);
+
+        table_ptr table_;
+        std::shared_ptr<const FrameCompressor> compressor_;
+
+        MessageKey cache_key_;
+        std::unique_ptr<std::atomic<cached_value*>[]> cache_;
+        std::atomic<std::size_t> cache_count_{ 0 };
+
+        // Writers only
+        std::mutex mtx_;
+        std::map<Subscriber*, member> members_;
+        std::vector<std::uint32_t> free_slots_;
+        std::uint32_t slot_count_ = 0;
     };
 
     //
     // This class manages socket timeouts by applying the concept of a deadline.
     // Some asynchronous operations are given deadlines by which they must complete.
-    // Deadlines are enforced by two "actors" that persist for the lifetime of the
-    // session object, one for input and one for output:
-    //
-    //  +----------------+                      +----------------+
-    //  |                |                      |                |
-    //  | check_deadline |<-------+             | check_deadline |<-------+
-    //  |                |        |             |                |        |
-    //  +----------------+        |             +----------------+        |
-    //               |            |                          |            |
-    //  async_wait() |    +----------------+    async_wait() |    +----------------+
-    //   on input    |    |     lambda     |     on output   |    |     lambda     |
-    //   deadline    +--->|       in       |     deadline    +--->|       in       |
-    //                    | check_deadline |                      | check_deadline |
-    //                    +----------------+                      +----------------+
-    //
-    // If either deadline actor determines that the corresponding deadline has
-    // expired, the socket is closed and any outstanding operations are cancelled.
+    // A session has two deadlines, one for input and one for output, kept as
+    // entries in the TimingWheel of the session's io_context:
+    //
+    //  +----------------+   ExpiresAfter()   +-----------------+
+    //  |   read_line /  |------------------->|   TimingWheel   |
+    //  |   write_line   |                    |  (one timer per |
+    //  +----------------+                    |   io_context)   |
+    //                                        +-----------------+
+    //                                                 |
+    //                                        expired  |  on the next tick
+    //                                                 V
+    //                                        +-----------------+
+    //                                        |      stop       |
+    //                                        +-----------------+
+    //
+    // Re-arming a deadline before every read and write only stores a new time
+    // point, instead of cancelling and re-queueing a steady_timer per session. If
+    // either deadline expires, the socket is closed and any outstanding operations
+    // are cancelled.
     //
     // The input actor reads messages from the socket, where messages are delimited
-    // by the newline character:
+    // by the newline character (or carry a length prefix, see FrameCodec):
     //
     //  +-------------+
     //  |             |
@@ -95,10 +267,17 @@ namespace SPSocket
     //          |           |
     //  async_- |    +-------------+
     //   read_- |    |   lambda    |
-    //  until() +--->|     in      |
+    //   some() +--->|     in      |
     //               |  read_line  |
     //               +-------------+
     //
+    // Each read fills the free space of a receive buffer (FrameReader). All the
+    // complete messages it then holds are extracted in a single pass, using a
+    // SIMD delimiter scan, and handed to OnReceiveBatch() in one call as views
+    // into that buffer, so no string is built per message. The next read is only started
+    // once no complete message is left. The consumed space is reclaimed by moving
+    // the trailing partial message to the front once the buffer's tail is used up.
+    //
     // The deadline for receiving a complete message is 30 seconds. If a non-empty
     // message is received, it is delivered to all subscribers. If a heartbeat (a
     // message that consists of a single newline character) is received, a heartbeat
@@ -107,94 +286,318 @@ namespace SPSocket
     //
     // The output actor is responsible for sending messages to the client:
     //
-    //  +----------------+
-    //  |                |<---------------------+
-    //  |  await_output  |                      |
-    //  |                |<-------+             |
-    //  +----------------+        |             |
-    //    |            |          |             |
-    //    |    async_- |  +----------------+    |
-    //    |     wait() |  |     lambda     |    |
-    //    |            +->|       in       |    |
-    //    |               |  await_output  |    |
-    //    |               +----------------+    |
-    //    V                                     |
+    //    deliver / heartbeat
+    //    (no write in flight)
+    //            |
+    //            V
     //  +--------------+               +--------------+
     //  |              | async_write() |    lambda    |
     //  |  write_line  |-------------->|      in      |
-    //  |              |               |  write_line  |
-    //  +--------------+               +--------------+
+    //  |              |<--------------|  write_line  |
+    //  +--------------+  queue still  +--------------+
+    //                     non-empty
     //
-    // The output actor first waits for an output message to be enqueued. It does
-    // this by using a steady_timer as an asynchronous condition variable. The
-    // steady_timer will be signalled whenever the output queue is non-empty.
+    // The output actor is idle while the output queue is empty and no write is in
+    // flight. Whoever puts a message into the queue in that state starts the write
+    // directly, so no timer is involved in waking the actor.
     //
-    // Once a message is available, it is sent to the client. The deadline for
-    // sending a complete message is 30 seconds. After the message is successfully
-    // sent, the output actor again waits for the output queue to become non-empty.
+    // Once a message is available, it is sent to the client. Everything already
+    // queued at that point, up to the coalescing limits, is gathered into the same
+    // async_write so a burst of small messages costs a single writev() call. The
+    // deadline for sending a complete message is 30 seconds. After the messages
+    // are successfully sent, the output actor writes whatever has been queued in
+    // the meantime, or goes idle if the queue is empty.
+    //
+    // The output queue can be capped in messages and bytes. What happens to a
+    // client that falls that far behind is up to the OverflowPolicy: it is either
+    // disconnected, or loses the oldest or newest messages. With O_CONFLATE a new
+    // message replaces the queued, not yet written message with the same key in
+    // place, so a lagging client only gets the latest update per key.
+    //
+    // All actors of a session run on the io_context its socket was accepted on.
+    // Messages may be delivered from any thread: they are pushed onto a lock-free
+    // inbox, and the producer that finds the inbox empty posts a single drain to
+    // the session's io_context, which moves the whole batch into the output queue.
+    // The session state is therefore only ever touched by one thread.
     //
     typedef class SPSocketServer* SPSocketServerPtr;
 
+    class TCP_Session;
+
+    // A cheap, copyable reference to one connected client, handed to the server's
+    // batched receive callback. It does not keep the session alive: once the client
+    // has gone, Send() simply returns false. Safe to use from any thread.
+    class SessionHandle {
+    public:
+
+        SessionHandle() = default;
+        explicit SessionHandle(const std::shared_ptr<TCP_Session>& session);
+
+        // Sends a message to this client only, framed according to the server's framing
+        bool Send(const std::string& msg) const;
+
+        // Sends an already framed, shared message to this client only
+        bool Send(const message_ptr& msg) const;
+
+        // Adds / removes this client to / from the receivers of SPSocketServer::Publish(topic),
+        // e.g. on a subscribe request from the client. False if it has disconnected.
+        bool Subscribe(const std::string& topic) const;
+        bool Unsubscribe(const std::string& topic) const;
+
+        bool IsOpen() const { return !session_.expired(); }
+
+        // Unique per server process, never reused
+        std::uint64_t Id() const { return id_; }
+        const std::string& Host() const { return host_; }
+        unsigned short Port() const { return port_; }
+
+    private:
+
+        std::weak_ptr<TCP_Session> session_;
+        std::uint64_t id_ = 0;
+        std::string host_;
+        unsigned short port_ = 0;
+    };
+
     class TCP_Session : public Subscriber, public std::enable_shared_from_this<TCP_Session> {
     public:
 
-        explicit TCP_Session(tcp::socket socket, Channel& ch, SPSocketServerPtr sp);
+        explicit TCP_Session(boost::asio::io_context& io_context, tcp::socket socket, Channel& ch, SPSocketServerPtr sp);
 
-        // Called by the server object to initiate the four actors.
+        // Called by the server object to initiate the actors, must be run on the
+        // session's own io_context.
         void Start();
 
         // Async read until terminator detected, return string via OnReceive
         void UseReadUntil(char terminator = '\n');
 
+        // Frame format used for both reading and sending, see FrameCodec
+        void UseFraming(const FrameCodec& codec);
+
         // Read timeout value in seconds, 0 = infinite (default)
         void UseReadWriteTimeOut(int rw_timeout_sec) { rw_timeout = rw_timeout_sec; }
 
-        // Broadcast message to all clients
-        void BroadCast(const std::string& msg) const { channel_.Deliver(msg); }
+        // Max bytes / buffers gathered into a single write, max_buffers = 1 disables coalescing
+        void UseWriteCoalescing(std::size_t max_bytes, std::size_t max_buffers);
+
+        // Limits of the output queue, 0 = unlimited (default), and what to do once exceeded
+        void UseOutputQueueLimit(std::size_t max_bytes, std::size_t max_msgs, OverflowPolicy policy);
+
+        // Key extractor for OverflowPolicy::O_CONFLATE
+        void UseConflationKey(const ConflationKey& key) { conflation_key = key; }
+
+        // Broadcast message to all clients, framed according to UseFraming()
+        void BroadCast(const std::string& msg) const { channel_.Deliver(MakeMessage(codec_.Encode(msg))); }
+        void BroadCast(const message_ptr& msg) const { channel_.Deliver(msg); }
+
+        // Send message to connecting client, framed according to UseFraming()
+        void Send(const std::string& msg) { deliver(MakeMessage(codec_.Encode(msg))); }
+        void Send(const message_ptr& msg) { deliver(msg); }
+
+        // Receive what the server publishes to this topic, safe to call from any thread
+        bool Subscribe(const std::string& topic) { return channel_.Subscribe(shared_from_this(), topic); }
+        bool Unsubscribe(const std::string& topic) { return channel_.Unsubscribe(shared_from_this(), topic); }
+
+        // Executor of the io_context this session runs on
+        tcp::socket::executor_type GetExecutor() { return socket_.get_executor(); }
 
-        // Send message to connecting client
-        void Send(const std::string& msg) { deliver(msg); }
+        // Handle identifying this session in the receive callbacks
+        const SessionHandle& GetHandle() const { return handle_; }
+
+        const std::string& GetHost() const { return remote_host_; }
+        unsigned short GetPort() const { return remote_port_; }
+        std::uint64_t GetId() const { return id_; }
+
+        // Counters of this session, safe to call from any thread
+        SessionStats GetStats() const;
+
+        // Leaves the channel and closes the connection without the callbacks, for
+        // a server going away. Nothing may run on the session's io_context meanwhile.
+        void Close();
+
+        // Closes the connection as if the client had gone, OnClientDisconnected
+        // included. On the session's io_context only.
+        void Stop() { stop(); }
 
     private:
-        
+
+        // A message waiting to be written, with the time it was delivered
+        struct queued_message {
+            message_ptr msg;
+            std::chrono::steady_clock::time_point enqueued;
+            std::uint64_t seq = 0;              // position in the output stream
+        };
+
+        // The gathered buffers as async_write sees them. It copies its buffer
+        // sequence into the operation, which for a vector means an allocation.
+        struct buffer_view {
+            typedef boost::asio::const_buffer value_type;
+            typedef const boost::asio::const_buffer* const_iterator;
+
+            const_iterator first;
+            const_iterator last;
+
+            const_iterator begin() const { return first; }
+            const_iterator end() const { return last; }
+        };
+
+        // A message on its way from deliver() to the output queue
+        struct delivery {
+            queued_message queued;
+            message_ptr original;               // before compression, for the conflation key
+        };
+
         void stop();
         bool stopped() const;
-        void deliver(const std::string& msg) override;
+        void deliver(const message_ptr& msg) override;
+        void deliver(const std::vector<message_ptr>& msgs) override;
+        void deliver(const message_ptr& msg, const message_ptr& original) override;
+        void wake();
+        void drain_inbox();
+        void enqueue(queued_message&& msg, const message_ptr& original);
+        void push_output(queued_message&& msg);
+        bool conflate(std::string_view key, queued_message& msg);
+        bool over_limit(std::size_t extra_bytes) const;
+        std::size_t in_flight() const { return write_in_progress_ ? write_buffers_.size() : 0; }
+        std::string_view payload_of(const std::string& msg) const;
         void read_line();
-        void await_output();
+        void reply_heartbeat();
+        void answer_compression(std::uint32_t dictionary_id);
+        void kick_output();
+        void update_queue_depth();
         void write_line();
-        void check_deadline(steady_timer& deadline);
+        void arm_deadline(const TimingWheel::entry_ptr& deadline);
 
     private:
 
         char read_terminator = '\n';
         int rw_timeout = 0;
+        std::size_t write_max_bytes = 64 * 1024;
+        std::size_t write_max_buffers = 64;
+        std::size_t queue_max_bytes = 0;
+        std::size_t queue_max_msgs = 0;
+        OverflowPolicy overflow_policy = OverflowPolicy::O_DISCONNECT;
+        ConflationKey conflation_key;
 
         SPSocketServerPtr socket_server_;
+        boost::asio::io_context& io_context_;
+        TimingWheel& timing_wheel_;
+
+        std::string remote_host_;
+        unsigned short remote_port_ = 0;
+        std::uint64_t id_ = 0;
+        SessionHandle handle_;
 
         Channel& channel_;
         tcp::socket socket_;
-        std::string input_buffer_;
-        steady_timer input_deadline_{ socket_.get_executor() };
-        std::deque<std::string> output_queue_;
-        steady_timer non_empty_output_queue_{ socket_.get_executor() };
-        steady_timer output_deadline_{ socket_.get_executor() };
+        FrameCodec codec_;
+        FrameReader frame_reader_;
+        std::vector<std::string_view> frames_;
+        TimingWheel::entry_ptr input_deadline_;
+        MPSCQueue<delivery> inbox_;
+        boost::circular_buffer<queued_message> output_queue_;     // grown on demand, keeps its capacity
+        std::size_t output_bytes_ = 0;
+        std::uint64_t next_seq_ = 0;
+        std::map<std::string, std::uint64_t, std::less<>> conflation_index_;    // key -> seq of its queued message
+        std::vector<boost::asio::const_buffer> write_buffers_;
+        bool write_in_progress_ = false;
+        bool compression_accepted_ = false;                 // the answer is queued, not yet written
+        std::uint64_t compression_answer_seq_ = 0;
+        TimingWheel::entry_ptr output_deadline_;
+        std::chrono::steady_clock::time_point write_started_;
+
+        // Written by the session's thread only, read by GetStats() from anywhere
+        std::atomic<std::uint64_t> bytes_in_{ 0 };
+        std::atomic<std::uint64_t> bytes_out_{ 0 };
+        std::atomic<std::uint64_t> msgs_in_{ 0 };
+        std::atomic<std::uint64_t> msgs_out_{ 0 };
+        std::atomic<std::uint64_t> queue_depth_{ 0 };
+        std::atomic<std::uint64_t> max_queue_depth_{ 0 };
+        std::atomic<std::uint64_t> queued_bytes_{ 0 };
+        std::atomic<std::uint64_t> dropped_{ 0 };
+        std::atomic<std::uint64_t> conflated_{ 0 };
+        std::atomic<bool> write_in_flight_{ false };
+
+        // At most one read, one write and one drain are in flight, their handlers
+        // are built in here
+        HandlerMemory read_memory_;
+        HandlerMemory write_memory_;
+        HandlerMemory drain_memory_;
     };
 
     typedef std::shared_ptr<TCP_Session> tcp_session_ptr;
 
     //----------------------------------------------------------------------
 
-    class UDP_Broadcaster : public Subscriber {
+    //
+    // Sends every broadcast as one datagram to each of its endpoints, be it a
+    // broadcast address, a multicast group or a list of unicast targets. deliver()
+    // only queues the message, the io_context thread sends whatever is pending
+    // once the socket is writable: on Linux up to max_batch datagrams per
+    // sendmmsg call, elsewhere one async_send_to at a time. Nothing blocks, so a
+    // broadcast never holds up the TCP sessions. A datagram that cannot be sent is
+    // dropped and counted, as is the oldest pending one beyond max_pending.
+    //
+    //   pending_:  [ m1 | m2 | m3 ... ]  x  endpoints_: [ e0 | e1 ]
+    //   datagrams:   m1>e0  m1>e1  m2>e0  m2>e1 ...    (next_endpoint_ = where m1 is at)
+    //
+    // With the sequence header every datagram starts with its message's number
+    // (see EncodeSequence), the same for all endpoints, so receivers can detect loss.
+    //
+    // The counters are its own, not the server's: handlers still queued on the
+    // io_context keep the broadcaster alive after the server is gone.
+    //
+    class UDP_Broadcaster : public Subscriber, public std::enable_shared_from_this<UDP_Broadcaster> {
     public:
 
         explicit UDP_Broadcaster(boost::asio::io_context& io_context, const udp::endpoint& broadcast_endpoint);
+        ~UDP_Broadcaster() noexcept;
+
+        // Before the first broadcast only. Endpoints must be of the same protocol (v4 / v6).
+        void AddEndpoint(const udp::endpoint& endpoint);
+        void UseSequenceHeader(bool enable) { sequence_header_ = enable; }
+        void UseMulticastHops(int hops);
+
+        static constexpr std::size_t max_batch = 64;
+        static constexpr std::size_t max_pending = 64 * 1024;
+
+        // See ServerMetrics, only the io_context thread records into them
+        Counter datagrams;
+        Counter datagram_errors;
+        Histogram datagrams_per_send;
 
     private:
 
-        void deliver(const std::string& msg);
+        struct pending_message {
+            message_ptr msg;
+            std::uint64_t seq;
+        };
 
+        void deliver(const message_ptr& msg) override;
+        void deliver(const std::vector<message_ptr>& msgs) override;
+
+        void flush();
+        void send_pending();
+        void advance(std::size_t count);
+
+        boost::asio::io_context& io_context_;
         udp::socket socket_;
+        std::vector<udp::endpoint> endpoints_;
+        bool sequence_header_ = false;
+
+        MPSCQueue<message_ptr> inbox_;
+
+        // Only touched by the io_context thread
+        std::deque<pending_message> pending_;
+        std::size_t next_endpoint_ = 0;
+        std::uint64_t next_seq_ = 1;
+        bool sending_ = false;
+        char headers_[max_batch][SEQUENCE_HEADER_SIZE];
+        HandlerMemory send_memory_;
+
+        // The sendmmsg arguments, kept across calls
+        struct batch;
+        std::unique_ptr<batch> batch_;
     };
 
     //----------------------------------------------------------------------
@@ -204,23 +607,121 @@ namespace SPSocket
 
         explicit SPSocketServer(boost::asio::io_context& io_context, const tcp::endpoint& listen_endpoint, const udp::endpoint& broadcast_endpoint);
 
-        virtual ~SPSocketServer() noexcept {};
+        // Stops the io_context pool, so no session handler runs past the members it
+        // uses, and closes the sessions' connections (those of session coroutines
+        // close once the pending accept is done with the pool). The On* callbacks of a derived class are gone
+        // before this runs, so stop what makes them fire (e.g. the clients' traffic,
+        // or StopServer()) first. Without a pool the sessions run on the io_context
+        // given to the constructor, which must not run them past this point either.
+        // That io_context must outlive the server, the accept still pending on it
+        // completes, or is destroyed, after the server is gone. So may a broadcast
+        // drain, broadcasts not yet delivered are discarded.
+        virtual ~SPSocketServer() noexcept;
 
         // Start Server
-        void StartServer() { OnServerStarted(); accept(); }
+        void StartServer();
 
         // Async read until terminator detected, return string via OnReceive
-        void UseReadUntil(char terminator = '\n') { read_terminator = terminator; }
+        void UseReadUntil(char terminator = '\n') { read_terminator = terminator; codec_.UseDelimiter(terminator); }
+
+        // Binary framing: each message is preceded by a 2 or 4 byte length header.
+        // Received frames are decoded in place, BroadCast() adds the header.
+        void UseLengthPrefix(std::size_t header_width = 4, ByteOrder order = ByteOrder::B_BIG_ENDIAN);
 
         // Read timeout value in seconds, 0 = infinite (default)
         void UseReadWriteTimeOut(int rw_timeout_sec) { read_write_timeout = rw_timeout_sec; }
 
-        // Broadcast messsage to all connecting clients
-        void BroadCast(const std::string& msg) { channel_.Deliver(msg); }
+        // Max bytes / buffers gathered into a single write per session (default 64KB / 64),
+        // max_buffers = 1 sends one message per write
+        void UseWriteCoalescing(std::size_t max_bytes, std::size_t max_buffers) { write_max_bytes = max_bytes; write_max_buffers = max_buffers; }
 
-        // Stop Server
+        // Caps every session's output queue, 0 = unlimited (default). A client that
+        // falls further behind is handled according to the policy, so one slow
+        // consumer cannot grow the server's memory without bound.
+        void UseOutputQueueLimit(std::size_t max_bytes, std::size_t max_msgs, OverflowPolicy policy = OverflowPolicy::O_DISCONNECT)
+        {
+            queue_max_bytes = max_bytes; queue_max_msgs = max_msgs; overflow_policy = policy;
+        }
+
+        // Tells OverflowPolicy::O_CONFLATE which messages supersede each other, e.g. the
+        // instrument code of a price update
+        void UseConflationKey(const ConflationKey& key) { conflation_key = key; }
+
+        // Compresses broadcasts and publishes to the clients that ask for it (see
+        // SPSocketClient::UseCompression), once per message for all of them, with
+        // a dictionary both ends share. Clients asking with another dictionary are
+        // refused and get plain messages. Only with a 4 byte length prefix, and needs
+        // SPSOCKET_WITH_ZLIB. Must be called after UseLengthPrefix, before StartServer.
+        void UseCompression(const std::string& dictionary, int level = 6);
+
+        // Market-data style broadcasts where only the latest message per key matters.
+        // The server keeps the last broadcast per key and sends all of them to every
+        // client when it connects. The key is also the conflation key, but the
+        // overflow policy is left alone: for lagging clients to get conflated
+        // updates rather than every intermediate one, also call
+        // UseOutputQueueLimit(..., O_CONFLATE), in either order (with 0, 0 to
+        // conflate without a limit). Must be called before StartServer.
+        void UseLastValueCache(const ConflationKey& key);
+
+        // Spreads accepted sessions round-robin over a pool of io_contexts, each run
+        // by its own (optionally core-pinned) thread. The io_context given to the
+        // constructor then only runs the acceptor. Must be called before StartServer.
+        // Note the On* callbacks will be invoked concurrently from the pool threads.
+        void UseIOContextPool(std::size_t pool_size = std::thread::hardware_concurrency(), bool pin_threads = true);
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+        typedef std::function<awaitable<void>(CoSession)> SessionCoroutine;
+
+        // Runs every accepted connection as this coroutine instead of a TCP_Session,
+        // for request / response protocols written straight-line (see CoSession).
+        // Such sessions get no broadcasts, timeouts or heartbeat replies. The
+        // connection is closed when the coroutine returns, an error other than
+        // the peer closing goes to OnReceiveError. Must be called before StartServer.
+        void UseSessionCoroutine(const SessionCoroutine& coroutine) { session_coroutine_ = coroutine; }
+#endif
+
+        // Broadcast messsage to all connecting clients. Safe to call from any thread and
+        // never blocks, the io_context thread delivers whatever is pending in batches.
+        void BroadCast(const std::string& msg) { BroadCast(MakeMessage(codec_.Encode(msg))); }
+
+        // Broadcast an already shared message, e.g. one built with MakeMessage(). It
+        // is sent as is, in length-prefix mode it must already carry its header.
+        void BroadCast(const message_ptr& msg);
+
+        // Sends to the clients subscribed to the topic only (see SessionHandle::Subscribe),
+        // the UDP broadcast does not get it. Safe to call from any thread, the message
+        // is handed to the subscribed sessions right away.
+        void Publish(std::string_view topic, const std::string& msg) { Publish(topic, MakeMessage(codec_.Encode(msg))); }
+        void Publish(std::string_view topic, const message_ptr& msg) { channel_.Publish(topic, msg); }
+
+        // Number of clients subscribed to the topic
+        std::size_t SubscriberCount(std::string_view topic) { return channel_.SubscriberCount(topic); }
+
+        // Additional UDP destinations for broadcasts, e.g. a list of unicast targets
+        // next to the one given to the constructor. Must be called before StartServer.
+        void AddBroadcastEndpoint(const udp::endpoint& endpoint) { broadcaster_->AddEndpoint(endpoint); }
+
+        // Prefix every UDP datagram with its message's sequence number (see EncodeSequence)
+        void UseBroadcastSequence(bool enable = true) { broadcaster_->UseSequenceHeader(enable); }
+
+        // Time-to-live of multicast datagrams, 1 (default) keeps them on the local network
+        void UseMulticastHops(int hops) { broadcaster_->UseMulticastHops(hops); }
+
+        // Stops accepting and disconnects every client, each session closes on its
+        // own io_context thread (OnClientDisconnected follows). Session coroutines run
+        // until they return. The io_context pool keeps running until the server is
+        // destroyed, so this is safe to call from any thread, the On* callbacks included.
         void StopServer();
 
+        // Server-wide counters and latency histograms plus the counters of every
+        // connected session. Safe to call from any thread, none of the counters
+        // are locked while being updated, so the figures are only approximately
+        // consistent with each other.
+        ServerMetricsSnapshot GetMetrics() const;
+
+        // The same as text, deepest session queues (the slow consumers) first
+        std::string DumpMetrics() const { return FormatMetrics(GetMetrics()); }
+
     public:
 
         // Client shall extend from this class and will need to override following methods
@@ -231,16 +732,74 @@ namespace SPSocket
         virtual void OnReceiveError(const std::string& msg) = 0;
         virtual void OnReceive(const std::string& msg) = 0;
 
+        // Override to get length-prefixed frames without copying them into a string,
+        // the view is only valid for the duration of the call. Forwards to OnReceive.
+        virtual void OnReceiveView(std::string_view msg) { OnReceive(std::string(msg)); }
+
+        // Every message decoded from one read of one client, heartbeats excluded.
+        // Override to process a whole burst at once and to know who sent it, e.g. to
+        // reply with session.Send() instead of a broadcast. The views are only valid
+        // for the duration of the call. Forwards each message to OnReceiveView.
+        virtual void OnReceiveBatch(const SessionHandle& /*session*/, const std::vector<std::string_view>& msgs)
+        {
+            for (const auto& msg : msgs)
+                OnReceiveView(msg);
+        }
+
     private:
 
+        friend class TCP_Session;
+
         void accept();
+        void start_session(boost::asio::io_context& session_context, tcp::socket socket);
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+        awaitable<void> run_session(CoSession session);
+#endif
+        void drain_broadcasts();
+        void register_session(const tcp_session_ptr& session);
+        void unregister_session(std::uint64_t id);
 
         char read_terminator = '\n';
         int read_write_timeout = 0;
+        std::size_t write_max_bytes = 64 * 1024;
+        std::size_t write_max_buffers = 64;
+        std::size_t queue_max_bytes = 0;
+        std::size_t queue_max_msgs = 0;
+        OverflowPolicy overflow_policy = OverflowPolicy::O_DISCONNECT;
+        ConflationKey conflation_key;
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+        SessionCoroutine session_coroutine_;
+#endif
+
+        FrameCodec codec_;
+        std::shared_ptr<const FrameCompressor> compressor_;
+        std::uint32_t dictionary_id_ = 0;       // 0 = no compression
 
         boost::asio::io_context& io_context_;
+        std::unique_ptr<IOContextPool> io_context_pool_;
         tcp::acceptor acceptor_;
         Channel channel_;
+        std::shared_ptr<UDP_Broadcaster> broadcaster_;
+
+        // Only touched by the acceptor's thread
+        std::map<boost::asio::io_context*, std::shared_ptr<SlabPool>> session_pools_;
+
+        // The drains posted by BroadCast() may outlive the server on its
+        // io_context, they only reach it through the guard
+        struct drain_guard {
+            std::mutex mtx;
+            SPSocketServer* server;
+        };
+
+        MPSCQueue<message_ptr> broadcast_queue_;
+        std::vector<message_ptr> broadcast_batch_;
+        std::shared_ptr<drain_guard> drain_guard_;
+
+        ServerMetrics metrics_;
+
+        // Connected sessions by id, only locked on connect, disconnect and GetMetrics()
+        mutable std::mutex sessions_mtx_;
+        std::map<std::uint64_t, std::weak_ptr<TCP_Session>> sessions_;
     };
 }
 
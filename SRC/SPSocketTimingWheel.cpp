@@ -0,0 +1,146 @@
+#include "SPSocketTimingWheel.h"
+
+namespace SPSocket
+{
+    boost::asio::io_context::id TimingWheel::id;
+
+    TimingWheel::TimingWheel(boost::asio::io_context& io_context)
+        : boost::asio::io_context::service(io_context),
+        timer_(io_context),
+        slots_(slot_count)
+    {
+    }
+
+    TimingWheel& TimingWheel::Get(boost::asio::io_context& io_context)
+    {
+        return boost::asio::use_service<TimingWheel>(io_context);
+    }
+
+    TimingWheel::entry_ptr TimingWheel::CreateEntry(std::function<void()> on_expire)
+    {
+        return std::make_shared<Entry>(std::move(on_expire));
+    }
+
+    void TimingWheel::ExpiresAfter(const entry_ptr& entry, clock_type::duration timeout)
+    {
+        entry->expiry_ = clock_type::now() + timeout;
+
+        // Already in a slot, the sweep moves it along once it gets there.
+        if (!entry->in_wheel_)
+            insert(entry);
+    }
+
+    void TimingWheel::insert(const entry_ptr& entry)
+    {
+        if (shut_down_)
+            return;
+
+        start_ticking();
+
+        // Round up, so an entry is never swept before it is due, and keep it
+        // within one revolution. Farther expiries are re-bucketed when swept.
+        auto delta = entry->expiry_ - cursor_time_;
+        std::size_t ticks = delta > clock_type::duration::zero()
+            ? static_cast<std::size_t>((delta + tick_interval - clock_type::duration(1)) / tick_interval)
+            : 1;
+        if (ticks < 1)
+            ticks = 1;
+        if (ticks > slot_count - 1)
+            ticks = slot_count - 1;
+
+        slots_[(cursor_ + ticks) % slot_count].push_back(entry);
+        entry->in_wheel_ = true;
+        ++size_;
+    }
+
+    void TimingWheel::start_ticking()
+    {
+        if (ticking_)
+            return;
+
+        // The wheel was empty, so the cursor can simply restart from now.
+        ticking_ = true;
+        cursor_time_ = clock_type::now();
+
+        schedule_tick();
+    }
+
+    void TimingWheel::schedule_tick()
+    {
+        timer_.expires_at(cursor_time_ + tick_interval);
+        timer_.async_wait(MakeCustomAllocHandler(tick_memory_, [this](const boost::system::error_code& error)
+        {
+            if (!error)
+                tick();
+        }));
+    }
+
+    void TimingWheel::tick()
+    {
+        if (shut_down_)
+            return;
+
+        clock_type::time_point now = clock_type::now();
+
+        // Catch up on every slot that has come due, at most one full revolution.
+        for (std::size_t n = 0; n < slot_count && cursor_time_ + tick_interval <= now; ++n)
+        {
+            cursor_ = (cursor_ + 1) % slot_count;
+            cursor_time_ += tick_interval;
+
+            // Take the slot out first, expiry callbacks may arm entries again.
+            sweep_.swap(slots_[cursor_]);
+            for (const auto& weak : sweep_)
+            {
+                entry_ptr entry = weak.lock();
+                if (!entry)
+                {
+                    // Its owner is gone.
+                    --size_;
+                }
+                else if (!entry->Armed() || entry->expiry_ <= now)
+                {
+                    bool expired = entry->Armed();
+                    entry->in_wheel_ = false;
+                    entry->expiry_ = clock_type::time_point::max();
+                    --size_;
+
+                    if (expired)
+                        entry->on_expire_();
+                }
+                else
+                {
+                    // Pushed back since it was bucketed, move it to its new slot.
+                    entry->in_wheel_ = false;
+                    --size_;
+                    insert(entry);
+                }
+            }
+            sweep_.clear();
+        }
+
+        if (cursor_time_ + tick_interval <= now)
+            cursor_time_ = now;
+
+        // Stop ticking once the wheel is empty, until the next entry is armed.
+        if (size_ == 0)
+        {
+            ticking_ = false;
+            return;
+        }
+
+        schedule_tick();
+    }
+
+    void TimingWheel::shutdown()
+    {
+        shut_down_ = true;
+
+        boost::system::error_code ignored_error;
+        timer_.cancel(ignored_error);
+
+        for (auto& slot : slots_)
+            slot.clear();
+        size_ = 0;
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef _SP_SOCKET_TIMING_WHEEL_H_
+#define _SP_SOCKET_TIMING_WHEEL_H_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "SPSocketAllocator.h"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace SPSocket
+{
+    //
+    // A coarse-grained timing wheel shared by everything running on one io_context,
+    // obtained with TimingWheel::Get(io_context). It replaces a steady_timer per
+    // deadline: arming or pushing back a deadline is O(1) and touches no lock,
+    // while a single steady_timer ticks the wheel for all of them.
+    //
+    //  slot:   0     1     2           cursor_            N-1
+    //        +-----+-----+-----+- ... -+-----+-- ... --+-----+
+    //        |     | e,e |     |       |  e  |         |     |
+    //        +-----+-----+-----+- ... -+-----+-- ... --+-----+
+    //                                     ^ swept every tick
+    //
+    // An entry is put in the slot of its expiry when first armed. Pushing the
+    // expiry back later only stores the new time point; the entry is moved to its
+    // new slot when the sweep reaches the old one (lazy cascading). Expiries
+    // further away than one revolution go to the farthest slot and are re-bucketed
+    // the same way, so the wheel covers any timeout with a fixed number of slots.
+    //
+    // Each tick only the current slot is swept. Deadlines therefore fire up to one
+    // tick late, which is fine for timeouts measured in seconds. The tick timer is
+    // only armed while entries are in the wheel, so an idle wheel does not keep
+    // io_context::run() from returning.
+    //
+    // Everything except destroying an entry must happen on the io_context's thread,
+    // i.e. the io_context must be run by a single thread, as in IOContextPool.
+    //
+    class TimingWheel : public boost::asio::io_context::service {
+    public:
+
+        typedef std::chrono::steady_clock clock_type;
+
+        class Entry {
+        public:
+            explicit Entry(std::function<void()> on_expire) : on_expire_(std::move(on_expire)) {}
+
+            bool Armed() const { return expiry_ != clock_type::time_point::max(); }
+
+        private:
+            friend class TimingWheel;
+
+            std::function<void()> on_expire_;
+            clock_type::time_point expiry_ = clock_type::time_point::max();
+            bool in_wheel_ = false;
+        };
+
+        typedef std::shared_ptr<Entry> entry_ptr;
+
+        static boost::asio::io_context::id id;
+
+        explicit TimingWheel(boost::asio::io_context& io_context);
+
+        // The wheel of the given io_context, created on first use
+        static TimingWheel& Get(boost::asio::io_context& io_context);
+
+        // Creates a disarmed deadline. on_expire runs on the io_context thread when
+        // it expires; the wheel only keeps a weak reference, so destroying the entry
+        // is all it takes to unregister it.
+        entry_ptr CreateEntry(std::function<void()> on_expire);
+
+        // Arms the deadline, or pushes it back if already armed. O(1)
+        void ExpiresAfter(const entry_ptr& entry, clock_type::duration timeout);
+
+        // Disarms the deadline. O(1)
+        void Cancel(const entry_ptr& entry) { entry->expiry_ = clock_type::time_point::max(); }
+
+        static constexpr std::chrono::milliseconds tick_interval{ 100 };
+        static constexpr std::size_t slot_count = 512;
+
+    private:
+
+        void shutdown() override;
+
+        void insert(const entry_ptr& entry);
+        void start_ticking();
+        void schedule_tick();
+        void tick();
+
+        boost::asio::steady_timer timer_;
+        HandlerMemory tick_memory_;
+        std::vector<std::vector<std::weak_ptr<Entry>>> slots_;
+        std::vector<std::weak_ptr<Entry>> sweep_;
+
+        std::size_t cursor_ = 0;
+        std::size_t size_ = 0;
+        bool ticking_ = false;
+        bool shut_down_ = false;
+
+        clock_type::time_point cursor_time_;
+    };
+}
+
+#endif
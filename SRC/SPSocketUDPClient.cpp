@@ -0,0 +1,237 @@
+#include "SPSocketUDPClient.h"
+
+#include <boost/asio/dispatch.hpp>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace SPSocket
+{
+#if defined(__linux__)
+	struct SPSocketUDPClient::batch {
+		mmsghdr msgs[max_batch];
+		iovec iov[max_batch];
+	};
+#else
+	struct SPSocketUDPClient::batch {};
+#endif
+
+	SPSocketUDPClient::SPSocketUDPClient(boost::asio::io_context& io_context)
+		: socket_(io_context), batch_(new batch())
+	{
+	}
+
+	SPSocketUDPClient::~SPSocketUDPClient() noexcept
+	{
+	}
+
+	void SPSocketUDPClient::Open(unsigned short port, const std::string& listen_address)
+	{
+		udp::endpoint listen_endpoint(boost::asio::ip::make_address(listen_address), port);
+
+		socket_.open(listen_endpoint.protocol());
+		socket_.set_option(udp::socket::reuse_address(true));
+		if (receive_buffer_size > 0)
+			socket_.set_option(udp::socket::receive_buffer_size(static_cast<int>(receive_buffer_size)));
+		socket_.bind(listen_endpoint);
+		socket_.non_blocking(true);
+
+#if defined(__linux__)
+		buffer_.resize(max_batch * max_datagram_size);
+		for (std::size_t i = 0; i < max_batch; ++i)
+		{
+			batch_->iov[i] = iovec{ buffer_.data() + i * max_datagram_size, max_datagram_size };
+			std::memset(&batch_->msgs[i], 0, sizeof(mmsghdr));
+			batch_->msgs[i].msg_hdr.msg_iov = &batch_->iov[i];
+			batch_->msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+#else
+		buffer_.resize(max_datagram_size);
+#endif
+
+		expected_seq_ = 0;
+		start_receive();
+	}
+
+	void SPSocketUDPClient::JoinGroup(const std::string& group, const std::string& interface_address)
+	{
+		boost::asio::ip::address group_address = boost::asio::ip::make_address(group);
+		if (group_address.is_v4() && !interface_address.empty())
+		{
+			socket_.set_option(boost::asio::ip::multicast::join_group(group_address.to_v4(),
+				boost::asio::ip::make_address_v4(interface_address)));
+		}
+		else
+		{
+			socket_.set_option(boost::asio::ip::multicast::join_group(group_address));
+		}
+	}
+
+	void SPSocketUDPClient::Close()
+	{
+		boost::asio::dispatch(socket_.get_executor(), [this]()
+		{
+			boost::system::error_code ignored_error;
+			socket_.close(ignored_error);
+		});
+	}
+
+#if defined(__linux__)
+	void SPSocketUDPClient::start_receive()
+	{
+		socket_.async_wait(udp::socket::wait_read,
+			[this](const boost::system::error_code& error) { handle_ready(error); });
+	}
+
+	void SPSocketUDPClient::handle_ready(const boost::system::error_code& error)
+	{
+		if (error)
+		{
+			if (error != boost::asio::error::operation_aborted)
+				OnReceiveError(error.message());
+			return;
+		}
+
+		// Take everything that has arrived, a batch at a time.
+		while (socket_.is_open())
+		{
+			int n = ::recvmmsg(socket_.native_handle(), batch_->msgs, max_batch, MSG_DONTWAIT, nullptr);
+			if (n < 0)
+			{
+				if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				{
+					metrics_.errors.Add();
+					OnReceiveError(std::strerror(errno));
+				}
+				break;
+			}
+
+			metrics_.reads.Add();
+			metrics_.datagrams_per_read.Record(static_cast<std::uint64_t>(n));
+			for (int i = 0; i < n; ++i)
+			{
+				process(buffer_.data() + i * max_datagram_size, batch_->msgs[i].msg_len,
+					(batch_->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0);
+			}
+
+			if (n < static_cast<int>(max_batch))
+				break;
+		}
+
+		if (socket_.is_open())
+			start_receive();
+	}
+#else
+	void SPSocketUDPClient::start_receive()
+	{
+		socket_.async_receive(boost::asio::buffer(buffer_),
+			[this](const boost::system::error_code& error, std::size_t n) { handle_receive(error, n); });
+	}
+#endif
+
+	void SPSocketUDPClient::handle_receive(const boost::system::error_code& error, std::size_t n)
+	{
+		if (error == boost::asio::error::operation_aborted)
+			return;
+
+		if (error && error != boost::asio::error::message_size)
+		{
+			metrics_.errors.Add();
+			OnReceiveError(error.message());
+		}
+		else
+		{
+			metrics_.reads.Add();
+			metrics_.datagrams_per_read.Record(1);
+			process(buffer_.data(), n, error == boost::asio::error::message_size);
+		}
+
+		if (socket_.is_open())
+			start_receive();
+	}
+
+	void SPSocketUDPClient::process(const char* data, std::size_t size, bool truncated)
+	{
+		metrics_.datagrams.Add();
+		metrics_.bytes_in.Add(size);
+
+		if (truncated)
+		{
+			metrics_.errors.Add();
+			OnReceiveError("datagram larger than the max datagram size, dropped");
+			return;
+		}
+
+		if (sequence_header)
+		{
+			if (size < SEQUENCE_HEADER_SIZE)
+			{
+				metrics_.errors.Add();
+				OnReceiveError("datagram shorter than its sequence header, dropped");
+				return;
+			}
+			if (!check_sequence(DecodeSequence(data)))
+				return;
+
+			data += SEQUENCE_HEADER_SIZE;
+			size -= SEQUENCE_HEADER_SIZE;
+		}
+
+		// A datagram normally holds one framed message, but may hold several.
+		while (size > 0)
+		{
+			const char* payload = nullptr;
+			std::size_t payload_size = 0;
+			std::size_t consumed = 0;
+
+			FrameStatus status = codec_.Decode(data, size, payload, payload_size, consumed);
+			if (status == FrameStatus::F_INCOMPLETE && codec_.Mode() == FramingMode::F_DELIMITER)
+			{
+				// The datagram boundary ends the message as well.
+				payload = data;
+				payload_size = consumed = size;
+			}
+			else if (status != FrameStatus::F_COMPLETE)
+			{
+				metrics_.errors.Add();
+				OnReceiveError("malformed frame in datagram, dropped");
+				return;
+			}
+
+			// Empty frames are heartbeats.
+			if (payload_size > 0)
+			{
+				metrics_.msgs_in.Add();
+				OnReceiveView(std::string_view(payload, payload_size));
+			}
+			data += consumed;
+			size -= consumed;
+		}
+	}
+
+	bool SPSocketUDPClient::check_sequence(std::uint64_t seq)
+	{
+		if (expected_seq_ == 0 || seq == expected_seq_ || (seq == 1 && expected_seq_ > 1))
+		{
+			// First datagram, in order, or the server started over.
+			expected_seq_ = seq + 1;
+			return true;
+		}
+
+		if (seq < expected_seq_)
+		{
+			metrics_.stale.Add();
+			return false;
+		}
+
+		std::uint64_t first_missing = expected_seq_;
+		expected_seq_ = seq + 1;
+		metrics_.gaps.Add();
+		metrics_.lost.Add(seq - first_missing);
+		OnGap(first_missing, seq);
+		return true;
+	}
+}
@@ -0,0 +1,125 @@
+#ifndef _SP_SOCKET_UDP_CLIENT_H_
+#define _SP_SOCKET_UDP_CLIENT_H_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/multicast.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SPSocketFraming.h"
+#include "SPSocketMetrics.h"
+
+namespace SPSocket
+{
+	using boost::asio::ip::udp;
+
+	//
+	// Receives the UDP feed of an SPSocketServer (see UDP_Broadcaster), unicast or
+	// from a multicast group, so a consumer needs no TCP session on the server.
+	// Many processes on one host can open the same port and group.
+	//
+	// A single receive actor waits for the socket to become readable and then
+	// takes everything queued on it, on Linux up to max_batch datagrams per
+	// recvmmsg call, elsewhere one async_receive at a time:
+	//
+	//  +---------------+  async_wait()   +---------------+
+	//  |               |---------------->|               |
+	//  | start_receive |                 | handle_ready  |--> recvmmsg() until empty
+	//  |               |<----------------|               |
+	//  +---------------+                 +---------------+
+	//
+	// Each datagram is cut into messages with the same framing as the server's
+	// broadcasts and handed to OnReceiveView() as a view into the receive buffer.
+	// With the sequence header (the server's UseBroadcastSequence) the numbers
+	// are checked first: a jump forward is reported once to OnGap() with the
+	// range of missing messages, a number already seen is dropped as stale.
+	// Sequence number 1 after a higher one is taken as the server restarting.
+	//
+	class SPSocketUDPClient {
+	public:
+
+		explicit SPSocketUDPClient(boost::asio::io_context& io_context);
+
+		virtual ~SPSocketUDPClient() noexcept;
+
+		// Binds to the port and starts receiving. Call from the io_context thread or
+		// before it runs, like the Use* options.
+		void Open(unsigned short port, const std::string& listen_address = "0.0.0.0");
+
+		// Receive from a multicast group as well, after Open()
+		void JoinGroup(const std::string& group, const std::string& interface_address = "");
+
+		// Stops receiving and closes the socket, safe to call from any thread
+		void Close();
+
+		bool IsOpen() const { return socket_.is_open(); }
+
+		// Datagrams start with a sequence number, must match the server's UseBroadcastSequence
+		void UseSequenceHeader(bool enable = true) { sequence_header = enable; }
+
+		// Framing of the messages, must match the server's
+		void UseReadUntil(char terminator = '\n') { codec_.UseDelimiter(terminator); }
+		void UseLengthPrefix(std::size_t header_width = 4, ByteOrder order = ByteOrder::B_BIG_ENDIAN) { codec_.UseLengthPrefix(header_width, order); }
+
+		// Largest datagram expected (default 8KB), anything longer is truncated and reported
+		void UseMaxDatagramSize(std::size_t bytes) { max_datagram_size = bytes; }
+
+		// SO_RCVBUF, raise it to ride out bursts without losing datagrams (0 = system default)
+		void UseReceiveBufferSize(std::size_t bytes) { receive_buffer_size = bytes; }
+
+		// Counters since construction, safe to call from any thread
+		FeedMetricsSnapshot GetMetrics() const { return metrics_.Snapshot(); }
+
+		// The same as text
+		std::string DumpMetrics() const { return FormatMetrics(GetMetrics()); }
+
+		// Next sequence number expected, 0 before the first one
+		std::uint64_t GetExpectedSequence() const { return expected_seq_; }
+
+		static constexpr std::size_t max_batch = 64;
+
+	public:
+
+		// Client shall extend from this class and will need to override following methods
+		virtual void OnReceiveError(const std::string& msg) = 0;
+		virtual void OnReceive(const std::string& msg) = 0;
+
+		// Override to get the messages without copying them into a string, the view is
+		// only valid for the duration of the call. Forwards to OnReceive.
+		virtual void OnReceiveView(std::string_view msg) { OnReceive(std::string(msg)); }
+
+		// Messages first_missing up to (excluding) next_received never arrived
+		virtual void OnGap(std::uint64_t /*first_missing*/, std::uint64_t /*next_received*/) {}
+
+	private:
+
+		void start_receive();
+		void handle_ready(const boost::system::error_code& error);
+		void handle_receive(const boost::system::error_code& error, std::size_t n);
+		void process(const char* data, std::size_t size, bool truncated);
+		bool check_sequence(std::uint64_t seq);
+
+		bool sequence_header = false;
+		std::size_t max_datagram_size = 8 * 1024;
+		std::size_t receive_buffer_size = 0;
+
+		FrameCodec codec_;
+		udp::socket socket_;
+
+		std::vector<char> buffer_;				// max_batch slots of max_datagram_size
+		std::uint64_t expected_seq_ = 0;
+
+		// The recvmmsg arguments, kept across calls
+		struct batch;
+		std::unique_ptr<batch> batch_;
+
+		FeedMetrics metrics_;
+	};
+}
+
+#endif // ! _SP_SOCKET_UDP_CLIENT_H_
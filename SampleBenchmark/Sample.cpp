@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include "SampleBenchmark.h"
+
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+
+using namespace SPSocket;
+
+// Count every heap allocation in the process, for the allocs/... figures.
+std::atomic<std::uint64_t> SPSocket::g_allocations{ 0 };
+std::atomic<std::uint64_t> SPSocket::g_flagged_allocations{ 0 };
+thread_local bool SPSocket::t_count_allocations = false;
+
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (t_count_allocations)
+        g_flagged_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+static void usage()
+{
+    std::cout << "usage: SampleBenchmark [options] [scenario...]" << std::endl
+        << "  scenarios: echo fanout flood stream churn producers udp reconnect pool compress teardown" << std::endl
+        << "             coecho (C++20 builds only), default: all" << std::endl
+        << "  --quick               smaller message counts, for a fast check" << std::endl
+        << "  --server-threads N    run sessions on an io_context pool of N threads (default 0: acceptor thread)" << std::endl
+        << "  --client-threads N    io_context threads shared by the clients (default 1)" << std::endl
+        << "  --port P              first loopback port to use, one per run (default 19500)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    typedef std::function<std::vector<BenchResult>(BenchOptions&)> scenario_fn;
+    const std::vector<std::pair<std::string, scenario_fn>> scenarios = {
+        { "echo", RunEcho },
+        { "fanout", RunFanOut },
+        { "flood", RunFlood },
+        { "stream", RunStream },
+        { "churn", RunChurn },
+        { "producers", RunProducers },
+        { "udp", RunUdp },
+        { "reconnect", RunReconnect },
+        { "pool", RunPool },
+        { "compress", RunCompress },
+        { "teardown", RunTeardown },
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+        { "coecho", RunCoEcho },
+#endif
+    };
+
+    BenchOptions options;
+    std::vector<std::string> selected;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--quick")
+            options.quick = true;
+        else if (arg == "--server-threads" && i + 1 < argc)
+            options.server_threads = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--client-threads" && i + 1 < argc)
+            options.client_threads = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--port" && i + 1 < argc)
+            options.base_port = static_cast<unsigned short>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg.size() > 0 && arg[0] != '-')
+            selected.push_back(arg);
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    std::cout << "server threads: " << options.server_threads
+        << ", client threads: " << options.client_threads
+        << ", hardware threads: " << std::thread::hardware_concurrency()
+        << (options.quick ? ", quick" : "") << std::endl << std::endl;
+
+    PrintHeader();
+
+    bool completed = true;
+    for (const auto& scenario : scenarios)
+    {
+        if (!selected.empty() && std::find(selected.begin(), selected.end(), scenario.first) == selected.end())
+            continue;
+
+        for (const auto& result : scenario.second(options))
+        {
+            PrintResult(result);
+            completed = completed && result.completed && result.passed;
+        }
+    }
+
+    return completed ? 0 : 1;
+}
@@ -0,0 +1,1365 @@
+
+#include "SampleBenchmark.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace SPSocket
+{
+	std::uint64_t NowNs()
+	{
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	std::string MakePayload(std::size_t size)
+	{
+		std::string payload(std::max<std::size_t>(size, sizeof(std::uint64_t)), 'x');
+		std::uint64_t stamp = NowNs();
+		std::memcpy(&payload[0], &stamp, sizeof(stamp));
+		return payload;
+	}
+
+	std::uint64_t PayloadAge(std::string_view payload)
+	{
+		if (payload.size() < sizeof(std::uint64_t))
+			return 0;
+
+		std::uint64_t stamp;
+		std::memcpy(&stamp, payload.data(), sizeof(stamp));
+		std::uint64_t now = NowNs();
+		return now > stamp ? now - stamp : 0;
+	}
+
+	//----------------------------------------------------------------------
+
+	void BenchServer::OnReceiveBatch(const SessionHandle& session, const std::vector<std::string_view>& msgs)
+	{
+		std::uint64_t bytes = 0;
+		for (const auto& msg : msgs)
+		{
+			bytes += msg.size();
+			if (mode_ == BenchMode::M_ECHO)
+				session.Send(std::string(msg));
+			else
+				latency.Record(PayloadAge(msg));
+		}
+		received_bytes.fetch_add(bytes, std::memory_order_relaxed);
+		received.fetch_add(msgs.size(), std::memory_order_relaxed);
+	}
+
+	void BenchClient::OnReceiveView(std::string_view msg)
+	{
+		latency_.Record(PayloadAge(msg));
+		received_bytes.fetch_add(msg.size(), std::memory_order_relaxed);
+		received.fetch_add(1, std::memory_order_relaxed);
+
+		if (echo_remaining_ > 0)
+		{
+			--echo_remaining_;
+			Send(MakePayload(echo_size_));
+		}
+	}
+
+	void BenchPool::OnReceive(std::size_t /*connection*/, std::string_view msg)
+	{
+		latency.Record(PayloadAge(msg));
+		received.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void BenchFeed::OnGap(std::uint64_t first_missing, std::uint64_t next_received)
+	{
+		gap_lost.fetch_add(next_received - first_missing, std::memory_order_relaxed);
+	}
+
+	//----------------------------------------------------------------------
+
+	BenchHarness::BenchHarness(BenchMode mode, unsigned short port, std::size_t server_threads, std::size_t client_threads,
+		const std::vector<udp::endpoint>& udp_endpoints, const std::string& dictionary)
+		: port_(port),
+		dictionary_(dictionary),
+		client_pool_(client_threads > 0 ? client_threads : 1, false)
+	{
+		// Unless told otherwise UDP goes to the discard port where nobody listens.
+		server_.reset(new BenchServer(server_context_,
+			tcp::endpoint(tcp::v4(), port),
+			udp_endpoints.empty() ? udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 9) : udp_endpoints.front(),
+			mode));
+		for (std::size_t i = 1; i < udp_endpoints.size(); ++i)
+			server_->AddBroadcastEndpoint(udp_endpoints[i]);
+		server_->UseBroadcastSequence(!udp_endpoints.empty());
+		server_->UseLengthPrefix();
+		if (!dictionary_.empty())
+			server_->UseCompression(dictionary_);
+		if (server_threads > 0)
+			server_->UseIOContextPool(server_threads, false);
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+		if (mode == BenchMode::M_CO_ECHO)
+		{
+			// The reply is written from the read buffer, which stays put until
+			// the next ReadFrame(). Only session coroutines run on the server's
+			// threads, so what is allocated there is theirs.
+			server_->UseSessionCoroutine([](CoSession session) -> awaitable<void>
+			{
+				t_count_allocations = true;
+				for (;;)
+				{
+					std::string_view msg = co_await session.ReadFrame();
+					co_await session.Write(msg);
+				}
+			});
+		}
+#endif
+		server_->StartServer();
+
+		server_thread_ = std::thread([this]() { server_context_.run(); });
+		client_pool_.Run();
+	}
+
+	BenchHarness::~BenchHarness() noexcept
+	{
+		// With the client threads stopped the clients can safely be shut from here.
+		client_pool_.Stop();
+		for (auto& client : clients_)
+			client->Disconnect();
+
+		// Let the sessions see the disconnects before the server pool goes away.
+		BenchServer& server = *server_;
+		WaitFor([&server]() { return server.disconnected >= server.connected; }, 2.0);
+
+		boost::asio::post(server_context_, [&server]() { server.StopServer(); });
+		WaitFor([this]() { return server_context_.stopped(); }, 1.0);
+		server_context_.stop();
+		if (server_thread_.joinable())
+			server_thread_.join();
+
+		clients_.clear();
+		server_.reset();
+	}
+
+	bool BenchHarness::AddClients(std::size_t n)
+	{
+		std::size_t first = clients_.size();
+		unsigned short port = port_;
+
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			boost::asio::io_context& io_context = client_pool_.GetIOContext();
+			clients_.emplace_back(new BenchClient(io_context, client_latency_));
+
+			BenchClient* client = clients_.back().get();
+			client->UseLengthPrefix();
+			if (!dictionary_.empty())
+				client->UseCompression(dictionary_);
+			boost::asio::post(io_context, [client, port]() { client->Connect("127.0.0.1", port); });
+		}
+
+		return WaitFor([this, first]()
+		{
+			for (std::size_t i = first; i < clients_.size(); ++i)
+			{
+				if (!clients_[i]->IsConnected())
+					return false;
+			}
+			return server_->connected >= static_cast<int>(clients_.size());
+		}, 10.0);
+	}
+
+	//----------------------------------------------------------------------
+
+	static std::string config_name(const char* a, std::size_t x)
+	{
+		return std::string(a) + "=" + std::to_string(x);
+	}
+
+	static std::string config_name(const char* a, std::size_t x, const char* b, std::size_t y)
+	{
+		std::ostringstream out;
+		out << a << "=" << x << " " << b << "=" << y;
+		return out.str();
+	}
+
+	static double seconds_between(std::chrono::steady_clock::time_point t0, std::chrono::steady_clock::time_point t1)
+	{
+		return std::chrono::duration<double>(t1 - t0).count();
+	}
+
+	std::vector<BenchResult> RunEcho(BenchOptions& options)
+	{
+		// Request / response round trips, one outstanding per client.
+		std::vector<BenchResult> results;
+		const std::uint64_t total = options.quick ? 20000 : 100000;
+
+		for (std::size_t clients : { 1, 16 })
+		{
+			for (std::size_t size : { 64, 1024 })
+			{
+				BenchResult result;
+				result.scenario = "echo";
+				result.config = config_name("clients", clients, "size", size);
+
+				BenchHarness harness(BenchMode::M_ECHO, options.base_port++, options.server_threads, options.client_threads);
+				if (!harness.AddClients(clients))
+				{
+					result.completed = false;
+					results.push_back(result);
+					continue;
+				}
+
+				const std::uint64_t per_client = total / clients;
+				auto t0 = std::chrono::steady_clock::now();
+				for (auto& client : harness.Clients())
+				{
+					client->UseEcho(size, per_client - 1);
+					client->Send(MakePayload(size));
+				}
+
+				auto& all = harness.Clients();
+				result.completed = WaitFor([&all, per_client]()
+				{
+					for (auto& client : all)
+					{
+						if (client->received < per_client)
+							return false;
+					}
+					return true;
+				}, 120.0);
+
+				result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+				result.msgs = per_client * clients;
+				result.bytes = result.msgs * size;
+				result.latency = harness.ClientLatency().Snapshot();
+				result.notes = "latency = round trip";
+				results.push_back(result);
+			}
+		}
+		return results;
+	}
+
+	std::vector<BenchResult> RunFanOut(BenchOptions& options)
+	{
+		// One broadcast delivered to every subscriber, throughput in deliveries.
+		std::vector<BenchResult> results;
+		const std::uint64_t msgs = options.quick ? 2000 : 10000;
+
+		// Allocations per broadcast at one subscriber, by size. More subscribers may
+		// add no more than this, anything growing with them is a leak in the fan-out.
+		std::map<std::size_t, double> single_allocs;
+		const double allocs_tolerance = 1.0;
+
+		for (std::size_t subscribers : { 1, 10, 100 })
+		{
+			for (std::size_t size : { 64, 1024 })
+			{
+				BenchResult result;
+				result.scenario = "fanout";
+				result.config = config_name("subs", subscribers, "size", size);
+
+				BenchHarness harness(BenchMode::M_SINK, options.base_port++, options.server_threads, options.client_threads);
+				if (!harness.AddClients(subscribers))
+				{
+					result.completed = false;
+					results.push_back(result);
+					continue;
+				}
+
+				auto& all = harness.Clients();
+				auto all_received = [&all](std::uint64_t n)
+				{
+					for (auto& client : all)
+					{
+						if (client->received < n)
+							return false;
+					}
+					return true;
+				};
+
+				// The first burst grows the queues of every session to their peak
+				// depth, the second one is measured, i.e. the steady state.
+				for (std::uint64_t i = 0; i < msgs; ++i)
+					harness.Server().BroadCast(MakePayload(size));
+				if (!WaitFor([&all_received, msgs]() { return all_received(msgs); }, 120.0))
+				{
+					result.completed = false;
+					results.push_back(result);
+					continue;
+				}
+
+				std::uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+				auto t0 = std::chrono::steady_clock::now();
+				for (std::uint64_t i = 0; i < msgs; ++i)
+					harness.Server().BroadCast(MakePayload(size));
+
+				result.completed = WaitFor([&all_received, msgs]() { return all_received(2 * msgs); }, 120.0);
+
+				result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+				allocations = g_allocations.load(std::memory_order_relaxed) - allocations;
+				result.msgs = msgs * subscribers;
+				result.bytes = result.msgs * size;
+				result.latency = harness.ClientLatency().Snapshot();
+
+				// Allocations per broadcast must not grow with the subscribers, and a
+				// burst should need fewer writes than messages.
+				double allocs = double(allocations) / double(msgs);
+				if (subscribers == 1)
+					single_allocs[size] = allocs;
+				else if (single_allocs.count(size) > 0 && allocs > single_allocs[size] + allocs_tolerance)
+					result.passed = false;
+
+				ServerMetricsSnapshot metrics = harness.Server().GetMetrics();
+				std::ostringstream notes;
+				notes << std::fixed << std::setprecision(2)
+					<< "allocs/bcast=" << allocs
+					<< " writes/msg=" << (metrics.msgs_out ? double(metrics.writes) / double(metrics.msgs_out) : 0.0)
+					<< " d2w_p99=" << metrics.deliver_to_wire.Percentile(0.99) / 1000.0 << "us";
+				if (!result.passed)
+					notes << " (" << single_allocs[size] << " at subs=1)";
+				result.notes = notes.str();
+				results.push_back(result);
+			}
+		}
+		return results;
+	}
+
+	std::vector<BenchResult> RunFlood(BenchOptions& options)
+	{
+		// Clients sending small messages as fast as they can, one thread each.
+		std::vector<BenchResult> results;
+		const std::uint64_t total = options.quick ? 100000 : 1000000;
+
+		for (std::size_t clients : { 1, 4 })
+		{
+			for (std::size_t size : { 16, 128 })
+			{
+				BenchResult result;
+				result.scenario = "flood";
+				result.config = config_name("clients", clients, "size", size);
+
+				BenchHarness harness(BenchMode::M_SINK, options.base_port++, options.server_threads, options.client_threads);
+				if (!harness.AddClients(clients))
+				{
+					result.completed = false;
+					results.push_back(result);
+					continue;
+				}
+
+				const std::uint64_t per_client = total / clients;
+				auto t0 = std::chrono::steady_clock::now();
+
+				std::vector<std::thread> producers;
+				for (auto& client : harness.Clients())
+				{
+					BenchClient* c = client.get();
+					producers.emplace_back([c, per_client, size]()
+					{
+						for (std::uint64_t i = 0; i < per_client; ++i)
+							c->Send(MakePayload(size));
+					});
+				}
+				for (auto& producer : producers)
+					producer.join();
+
+				BenchServer& server = harness.Server();
+				const std::uint64_t expected = per_client * clients;
+				result.completed = WaitFor([&server, expected]() { return server.received >= expected; }, 120.0);
+
+				result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+				result.msgs = expected;
+				result.bytes = expected * size;
+				result.latency = server.latency.Snapshot();
+				result.notes = "latency = Send() to server callback";
+				results.push_back(result);
+			}
+		}
+		return results;
+	}
+
+	std::vector<BenchResult> RunStream(BenchOptions& options)
+	{
+		// Large messages from one client, throttled by its queued bytes.
+		std::vector<BenchResult> results;
+		const std::uint64_t total_bytes = (options.quick ? 64ull : 512ull) * 1024 * 1024;
+		const std::size_t max_queued = 8 * 1024 * 1024;
+
+		for (std::size_t size : { 64 * 1024, 1024 * 1024 })
+		{
+			BenchResult result;
+			result.scenario = "stream";
+			result.config = config_name("clients", 1, "size", size);
+
+			BenchHarness harness(BenchMode::M_SINK, options.base_port++, options.server_threads, options.client_threads);
+			if (!harness.AddClients(1))
+			{
+				result.completed = false;
+				results.push_back(result);
+				continue;
+			}
+
+			BenchClient& client = *harness.Clients().front();
+			BenchServer& server = harness.Server();
+			const std::uint64_t count = total_bytes / size;
+
+			auto t0 = std::chrono::steady_clock::now();
+			for (std::uint64_t i = 0; i < count; ++i)
+			{
+				WaitFor([&client, max_queued]() { return client.GetQueuedBytes() < max_queued; }, 30.0);
+				client.Send(MakePayload(size));
+			}
+			result.completed = WaitFor([&server, count]() { return server.received >= count; }, 120.0);
+
+			result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+			result.msgs = count;
+			result.bytes = count * size;
+			result.latency = server.latency.Snapshot();
+			result.notes = "at most 8MB queued";
+			results.push_back(result);
+		}
+		return results;
+	}
+
+	std::vector<BenchResult> RunChurn(BenchOptions& options)
+	{
+		// Plain sockets connecting and closing again right away, to load the
+		// accept path and session setup / teardown only.
+		std::vector<BenchResult> results;
+		const std::uint64_t total = options.quick ? 2000 : 20000;
+
+		for (std::size_t threads : { 1, 4 })
+		{
+			BenchResult result;
+			result.scenario = "churn";
+			result.config = config_name("threads", threads);
+
+			BenchHarness harness(BenchMode::M_SINK, options.base_port++, options.server_threads, options.client_threads);
+			BenchServer& server = harness.Server();
+			Histogram connect_latency;
+
+			const std::uint64_t per_thread = total / threads;
+			const tcp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), harness.Port());
+
+			std::uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+			auto t0 = std::chrono::steady_clock::now();
+
+			std::vector<std::thread> connectors;
+			for (std::size_t t = 0; t < threads; ++t)
+			{
+				connectors.emplace_back([&connect_latency, &endpoint, per_thread]()
+				{
+					boost::asio::io_context io_context;
+					for (std::uint64_t i = 0; i < per_thread; ++i)
+					{
+						tcp::socket socket(io_context);
+						boost::system::error_code error;
+
+						auto start = std::chrono::steady_clock::now();
+						socket.connect(endpoint, error);
+						connect_latency.Record(std::chrono::steady_clock::now() - start);
+
+						socket.close(error);
+					}
+				});
+			}
+			for (auto& connector : connectors)
+				connector.join();
+
+			const std::uint64_t expected = per_thread * threads;
+			result.completed = WaitFor([&server, expected]()
+			{
+				ServerMetricsSnapshot metrics = server.GetMetrics();
+				return metrics.accepts >= expected && metrics.sessions.empty();
+			}, 60.0);
+
+			result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+			allocations = g_allocations.load(std::memory_order_relaxed) - allocations;
+			result.msgs = expected;
+			result.latency = connect_latency.Snapshot();
+
+			std::ostringstream notes;
+			notes << std::fixed << std::setprecision(2)
+				<< "msgs = connections, latency = connect(), allocs/conn=" << double(allocations) / double(expected);
+			result.notes = notes.str();
+			results.push_back(result);
+		}
+		return results;
+	}
+
+	std::vector<BenchResult> RunProducers(BenchOptions& options)
+	{
+		// Many threads broadcasting at once, every message must arrive exactly once.
+		std::vector<BenchResult> results;
+		const std::uint64_t per_producer = options.quick ? 5000 : 50000;
+		const std::size_t subscribers = 4;
+		const std::size_t size = 64;
+
+		for (std::size_t producers : { 1, 4, 16 })
+		{
+			BenchResult result;
+			result.scenario = "producers";
+			result.config = config_name("threads", producers, "subs", subscribers);
+
+			BenchHarness harness(BenchMode::M_SINK, options.base_port++, options.server_threads, options.client_threads);
+			if (!harness.AddClients(subscribers))
+			{
+				result.completed = false;
+				results.push_back(result);
+				continue;
+			}
+
+			BenchServer& server = harness.Server();
+			auto t0 = std::chrono::steady_clock::now();
+
+			std::vector<std::thread> threads;
+			for (std::size_t p = 0; p < producers; ++p)
+			{
+				threads.emplace_back([&server, per_producer, size]()
+				{
+					for (std::uint64_t i = 0; i < per_producer; ++i)
+						server.BroadCast(MakePayload(size));
+				});
+			}
+			for (auto& thread : threads)
+				thread.join();
+
+			const std::uint64_t expected = per_producer * producers;
+			auto& all = harness.Clients();
+			result.completed = WaitFor([&all, expected]()
+			{
+				for (auto& client : all)
+				{
+					if (client->received < expected)
+						return false;
+				}
+				return true;
+			}, 120.0);
+
+			result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+
+			// More than expected would mean duplicates, less is caught by the timeout.
+			std::uint64_t received = 0;
+			for (auto& client : all)
+				received += client->received;
+			if (received != expected * subscribers)
+				result.completed = false;
+
+			result.msgs = received;
+			result.bytes = received * size;
+			result.latency = harness.ClientLatency().Snapshot();
+
+			std::ostringstream notes;
+			notes << "delivered " << received << " of " << expected * subscribers;
+			result.notes = notes.str();
+			results.push_back(result);
+		}
+		return results;
+	}
+
+	std::vector<BenchResult> RunUdp(BenchOptions& options)
+	{
+		// Broadcasts over UDP only, throughput in datagrams sent, i.e. messages
+		// times endpoints. Each endpoint is an SPSocketUDPClient run by its own
+		// thread, which has to get every message without a gap.
+		std::vector<BenchResult> results;
+		const std::uint64_t msgs = options.quick ? 20000 : 200000;
+
+		for (std::size_t endpoints : { 1, 4 })
+		{
+			for (std::size_t size : { 64, 1024 })
+			{
+				BenchResult result;
+				result.scenario = "udp";
+				result.config = config_name("endpoints", endpoints, "size", size);
+
+				// UDP ports of their own, the harness takes the next TCP port.
+				Histogram latency{ Histogram::shared_shard_count };
+				std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+				std::vector<std::unique_ptr<BenchFeed>> feeds;
+				std::vector<udp::endpoint> targets;
+				for (std::size_t i = 0; i < endpoints; ++i)
+				{
+					const unsigned short port = static_cast<unsigned short>(options.base_port + i);
+					contexts.emplace_back(new boost::asio::io_context());
+					feeds.emplace_back(new BenchFeed(*contexts.back(), latency));
+					feeds.back()->UseSequenceHeader(true);
+					feeds.back()->UseLengthPrefix();
+					feeds.back()->UseReceiveBufferSize(8 * 1024 * 1024);
+					feeds.back()->Open(port, "127.0.0.1");
+					targets.push_back(udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+				}
+
+				BenchHarness harness(BenchMode::M_SINK, options.base_port++, options.server_threads, options.client_threads, targets);
+
+				std::vector<std::thread> readers;
+				for (auto& context : contexts)
+				{
+					boost::asio::io_context* io_context = context.get();
+					readers.emplace_back([io_context]() { io_context->run(); });
+				}
+
+				auto all_received = [&feeds]()
+				{
+					std::uint64_t received = 0;
+					for (const auto& feed : feeds)
+						received += feed->GetMetrics().msgs_in;
+					return received;
+				};
+
+				BenchServer& server = harness.Server();
+				auto t0 = std::chrono::steady_clock::now();
+				for (std::uint64_t i = 0; i < msgs; ++i)
+					server.BroadCast(MakePayload(size));
+
+				const std::uint64_t expected = msgs * endpoints;
+				result.completed = WaitFor([&server, expected]()
+				{
+					ServerMetricsSnapshot metrics = server.GetMetrics();
+					return metrics.datagrams + metrics.datagram_errors >= expected;
+				}, 120.0);
+				result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+
+				// Give the readers a moment for what is still in flight.
+				WaitFor([&all_received, expected]() { return all_received() >= expected; }, 2.0);
+				for (auto& feed : feeds)
+					feed->Close();
+				for (auto& reader : readers)
+					reader.join();
+
+				FeedMetricsSnapshot received;
+				for (const auto& feed : feeds)
+				{
+					FeedMetricsSnapshot m = feed->GetMetrics();
+					received.reads += m.reads;
+					received.msgs_in += m.msgs_in;
+					received.gaps += m.gaps;
+					received.lost += m.lost;
+					received.errors += m.errors;
+				}
+				if (received.msgs_in != expected || received.gaps != 0)
+					result.passed = false;
+
+				ServerMetricsSnapshot metrics = server.GetMetrics();
+				result.msgs = metrics.datagrams;
+				result.bytes = metrics.datagrams * size;
+				result.latency = latency.Snapshot();
+
+				std::ostringstream notes;
+				notes << std::fixed << std::setprecision(1)
+					<< "msgs = datagrams, received " << received.msgs_in << " of " << expected
+					<< " gaps=" << received.gaps << " lost=" << received.lost
+					<< " errors=" << metrics.datagram_errors + received.errors
+					<< " dgrams/send=" << metrics.datagrams_per_send.Mean()
+					<< " dgrams/read=" << (received.reads ? double(received.msgs_in) / double(received.reads) : 0.0);
+				result.notes = notes.str();
+				results.push_back(result);
+			}
+		}
+
+		results.push_back(RunUdpGaps(options));
+		return results;
+	}
+
+	BenchResult RunUdpGaps(BenchOptions& options)
+	{
+		// Datagrams of two messages each, sent straight from a socket with every
+		// tenth sequence number left out and one sent twice. The feed has to split
+		// them, report each hole once to OnGap and drop the duplicate as stale.
+		BenchResult result;
+		result.scenario = "udp";
+		result.config = "skip=1/10 msgs/dgram=2";
+
+		const std::uint64_t last_seq = options.quick ? 1001 : 10001;
+		const unsigned short port = options.base_port++;
+
+		boost::asio::io_context io_context;
+		Histogram latency;
+		BenchFeed feed(io_context, latency);
+		feed.UseSequenceHeader(true);
+		feed.UseLengthPrefix();
+		feed.Open(port, "127.0.0.1");
+		std::thread reader([&io_context]() { io_context.run(); });
+
+		FrameCodec codec;
+		codec.UseLengthPrefix();
+		boost::asio::io_context send_context;
+		udp::socket sender(send_context, udp::endpoint(udp::v4(), 0));
+		const udp::endpoint target(boost::asio::ip::make_address("127.0.0.1"), port);
+
+		std::uint64_t sent = 0;
+		std::uint64_t skipped = 0;
+		auto send = [&](std::uint64_t seq)
+		{
+			std::string datagram(SEQUENCE_HEADER_SIZE, '\0');
+			EncodeSequence(seq, &datagram[0]);
+			datagram += codec.Encode(MakePayload(64));
+			datagram += codec.Encode(MakePayload(64));
+			sender.send_to(boost::asio::buffer(datagram), target);
+		};
+
+		// Waits for the feed now and then, a real loss would spoil the count.
+		auto t0 = std::chrono::steady_clock::now();
+		for (std::uint64_t seq = 1; seq <= last_seq && result.completed; ++seq)
+		{
+			if (seq % 10 == 0)
+			{
+				++skipped;
+				continue;
+			}
+			send(seq);
+			if (++sent % 64 == 0)
+				result.completed = WaitFor([&feed, sent]() { return feed.GetMetrics().msgs_in >= 2 * sent; }, 5.0);
+		}
+		send(last_seq - 1);
+		result.completed = result.completed && WaitFor([&feed, sent]()
+		{
+			FeedMetricsSnapshot m = feed.GetMetrics();
+			return m.msgs_in >= 2 * sent && m.stale >= 1;
+		}, 5.0);
+		result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+
+		feed.Close();
+		reader.join();
+
+		FeedMetricsSnapshot metrics = feed.GetMetrics();
+		if (metrics.msgs_in != 2 * sent || metrics.gaps != skipped || metrics.lost != skipped ||
+			feed.gap_lost != skipped || metrics.stale != 1)
+		{
+			result.passed = false;
+		}
+
+		result.msgs = metrics.msgs_in;
+		result.bytes = metrics.bytes_in;
+		result.latency = latency.Snapshot();
+
+		std::ostringstream notes;
+		notes << "received " << metrics.msgs_in << " of " << 2 * sent
+			<< " gaps=" << metrics.gaps << " lost=" << metrics.lost << " OnGap lost=" << feed.gap_lost
+			<< " of " << skipped << " skipped, stale=" << metrics.stale;
+		result.notes = notes.str();
+		return result;
+	}
+
+	//
+	// A bare listener for the reconnect scenario. It holds on to whatever connects
+	// until Bounce() closes every connection and the listening socket, as a server
+	// restart would, and then listens again once the downtime is over.
+	//
+	class BounceServer {
+	public:
+
+		explicit BounceServer(unsigned short port)
+			: acceptor_(io_context_), timer_(io_context_), work_(boost::asio::make_work_guard(io_context_)), port_(port)
+		{
+			listen();
+			thread_ = std::thread([this]() { io_context_.run(); });
+		}
+
+		~BounceServer() noexcept
+		{
+			io_context_.stop();
+			thread_.join();
+		}
+
+		void Bounce(std::chrono::milliseconds downtime)
+		{
+			boost::asio::post(io_context_, [this, downtime]()
+			{
+				boost::system::error_code ignored_error;
+				for (auto& socket : sockets_)
+					socket->close(ignored_error);
+				sockets_.clear();
+				acceptor_.close(ignored_error);
+
+				timer_.expires_after(downtime);
+				timer_.async_wait([this](const boost::system::error_code& error)
+				{
+					if (!error)
+						listen();
+				});
+			});
+		}
+
+		std::atomic<std::uint64_t> accepted{ 0 };
+
+	private:
+
+		void listen()
+		{
+			tcp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), port_);
+			acceptor_.open(endpoint.protocol());
+			acceptor_.set_option(tcp::acceptor::reuse_address(true));
+			acceptor_.bind(endpoint);
+			acceptor_.listen();
+			accept();
+		}
+
+		void accept()
+		{
+			acceptor_.async_accept([this](const boost::system::error_code& error, tcp::socket socket)
+			{
+				if (error)
+					return;
+
+				sockets_.emplace_back(new tcp::socket(std::move(socket)));
+				accepted.fetch_add(1, std::memory_order_relaxed);
+				accept();
+			});
+		}
+
+		boost::asio::io_context io_context_;
+		tcp::acceptor acceptor_;
+		boost::asio::steady_timer timer_;
+		boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_;
+		std::vector<std::unique_ptr<tcp::socket>> sockets_;
+		unsigned short port_;
+		std::thread thread_;
+	};
+
+	static void merge_histogram(HistogramSnapshot& into, const HistogramSnapshot& from)
+	{
+		into.count += from.count;
+		into.sum += from.sum;
+		into.max = std::max(into.max, from.max);
+		if (into.buckets.size() < from.buckets.size())
+			into.buckets.resize(from.buckets.size());
+		for (std::size_t i = 0; i < from.buckets.size(); ++i)
+			into.buckets[i] += from.buckets[i];
+	}
+
+	//
+	// A listener that never accepts, with its backlog filled up, so that further
+	// connects to it go unanswered, as with a host that is down or firewalled.
+	//
+	class BlackholeServer {
+	public:
+
+		explicit BlackholeServer(unsigned short port)
+			: acceptor_(io_context_)
+		{
+			tcp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), port);
+			acceptor_.open(endpoint.protocol());
+			acceptor_.set_option(tcp::acceptor::reuse_address(true));
+			acceptor_.bind(endpoint);
+			acceptor_.listen(0);
+
+			for (int i = 0; i < 4; ++i)
+			{
+				fillers_.emplace_back(new tcp::socket(io_context_));
+				fillers_.back()->async_connect(endpoint, [](const boost::system::error_code& /*error*/) {});
+			}
+			io_context_.run_for(std::chrono::milliseconds(200));
+		}
+
+	private:
+
+		boost::asio::io_context io_context_;
+		tcp::acceptor acceptor_;
+		std::vector<std::unique_ptr<tcp::socket>> fillers_;
+	};
+
+	std::vector<BenchResult> RunReconnect(BenchOptions& options)
+	{
+		// Time to reconnect: the server drops every connection and stops listening
+		// for a while, as a restart would, and the clients find their own way back.
+		// Latency is from a client noticing the loss until it is connected again.
+		std::vector<BenchResult> results;
+		const std::size_t bounces = options.quick ? 3 : 10;
+
+		for (std::size_t clients : { 1, 16 })
+		{
+			for (std::size_t downtime_ms : { 0, 100 })
+			{
+				BenchResult result;
+				result.scenario = "reconnect";
+				result.config = config_name("clients", clients, "down_ms", downtime_ms);
+
+				BounceServer server(options.base_port);
+				const unsigned short port = options.base_port++;
+
+				IOContextPool client_pool(options.client_threads > 0 ? options.client_threads : 1, false);
+				client_pool.Run();
+
+				Histogram unused;
+				std::vector<std::unique_ptr<BenchClient>> all;
+				for (std::size_t i = 0; i < clients; ++i)
+				{
+					boost::asio::io_context& io_context = client_pool.GetIOContext();
+					all.emplace_back(new BenchClient(io_context, unused));
+
+					BenchClient* client = all.back().get();
+					client->UseLengthPrefix();
+					client->UseReconnect(true, 10, 1000);
+					boost::asio::post(io_context, [client, port]() { client->Connect("127.0.0.1", port); });
+				}
+
+				auto all_back = [&server, &all](std::uint64_t accepted)
+				{
+					if (server.accepted < accepted)
+						return false;
+					for (auto& client : all)
+					{
+						if (!client->IsConnected())
+							return false;
+					}
+					return true;
+				};
+				result.completed = WaitFor([&all_back, clients]() { return all_back(clients); }, 10.0);
+
+				auto t0 = std::chrono::steady_clock::now();
+				for (std::size_t b = 0; b < bounces && result.completed; ++b)
+				{
+					std::uint64_t expected = server.accepted + clients;
+					server.Bounce(std::chrono::milliseconds(downtime_ms));
+					result.completed = WaitFor([&all_back, expected]() { return all_back(expected); }, 30.0);
+				}
+				result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+
+				// With the client threads stopped the clients can safely be shut from here.
+				client_pool.Stop();
+				for (auto& client : all)
+				{
+					ClientMetricsSnapshot metrics = client->GetMetrics();
+					result.msgs += metrics.reconnects;
+					merge_histogram(result.latency, metrics.reconnect_time);
+					client->Disconnect();
+				}
+
+				result.notes = "msgs = reconnects, latency = connection lost until connected again";
+				results.push_back(result);
+			}
+		}
+
+		results.push_back(RunReconnectFailover(options));
+		return results;
+	}
+
+	BenchResult RunReconnectFailover(BenchOptions& options)
+	{
+		// The primary host neither takes nor refuses connections, so only the
+		// connect deadline gets the clients on to the failover host. That has to
+		// take about the read timeout, not the minutes until the system gives up
+		// on the connect. Latency is from Connect() until connected.
+		BenchResult result;
+		result.scenario = "reconnect";
+		const std::size_t clients = 16;
+		const int timeout_sec = 1;
+		result.config = config_name("clients", clients) + " failover";
+
+		BlackholeServer primary(options.base_port);
+		const unsigned short primary_port = options.base_port++;
+		BounceServer failover(options.base_port);
+		const unsigned short failover_port = options.base_port++;
+
+		IOContextPool client_pool(options.client_threads > 0 ? options.client_threads : 1, false);
+		client_pool.Run();
+
+		Histogram unused;
+		std::vector<std::unique_ptr<BenchClient>> all;
+		auto t0 = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < clients; ++i)
+		{
+			boost::asio::io_context& io_context = client_pool.GetIOContext();
+			all.emplace_back(new BenchClient(io_context, unused));
+
+			BenchClient* client = all.back().get();
+			client->UseLengthPrefix();
+			client->UseReadTimeOut(timeout_sec);
+			client->UseReconnect(true, 10, 1000);
+			client->AddFailoverHost("127.0.0.1", failover_port);
+			boost::asio::post(io_context, [client, primary_port]() { client->Connect("127.0.0.1", primary_port); });
+		}
+
+		// Each client counts once, when first seen connected.
+		Histogram latency;
+		std::vector<bool> seen(clients, false);
+		std::size_t connected = 0;
+		result.completed = WaitFor([&]()
+		{
+			for (std::size_t i = 0; i < clients; ++i)
+			{
+				if (!seen[i] && all[i]->IsConnected())
+				{
+					seen[i] = true;
+					++connected;
+					latency.Record(std::chrono::steady_clock::now() - t0);
+				}
+			}
+			return connected == clients;
+		}, 10.0 * timeout_sec);
+		result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+
+		client_pool.Stop();
+		std::uint64_t timeouts = 0;
+		for (auto& client : all)
+		{
+			timeouts += client->GetMetrics().timeouts;
+			client->Disconnect();
+		}
+
+		result.msgs = connected;
+		result.latency = latency.Snapshot();
+		if (failover.accepted < clients || timeouts < clients)
+			result.passed = false;
+
+		std::ostringstream notes;
+		notes << "msgs = connects, latency = Connect() until connected, primary blackholed, "
+			<< connected << " of " << clients << " on the failover host, " << timeouts << " timeouts";
+		result.notes = notes.str();
+		return result;
+	}
+
+	std::vector<BenchResult> RunPool(BenchOptions& options)
+	{
+		// Requests from several threads spread over a pool of connections to an
+		// echo server, every one must come back. Latency is the round trip.
+		std::vector<BenchResult> results;
+		const std::uint64_t per_producer = options.quick ? 5000 : 50000;
+		const std::size_t producers = 4;
+		const std::size_t size = 64;
+
+		for (std::size_t connections : { std::size_t(16), std::size_t(options.quick ? 256 : 1000) })
+		{
+			BenchResult result;
+			result.scenario = "pool";
+			result.config = config_name("conns", connections, "threads", producers);
+
+			BenchHarness harness(BenchMode::M_ECHO, options.base_port++, options.server_threads, 1);
+			BenchPool pool(options.client_threads > 0 ? options.client_threads : 1);
+			pool.UseLengthPrefix();
+			pool.Connect("127.0.0.1", harness.Port(), connections);
+
+			result.completed = WaitFor([&pool, connections]() { return pool.ConnectedCount() == connections; }, 30.0);
+			if (!result.completed)
+			{
+				results.push_back(result);
+				continue;
+			}
+
+			auto t0 = std::chrono::steady_clock::now();
+			std::atomic<std::uint64_t> rejected{ 0 };
+
+			std::vector<std::thread> threads;
+			for (std::size_t p = 0; p < producers; ++p)
+			{
+				threads.emplace_back([&pool, &rejected, per_producer, size]()
+				{
+					for (std::uint64_t i = 0; i < per_producer; ++i)
+					{
+						// Every connection backed up: wait for the writes to catch up.
+						while (!pool.Send(MakePayload(size)))
+						{
+							++rejected;
+							std::this_thread::yield();
+						}
+					}
+				});
+			}
+			for (auto& thread : threads)
+				thread.join();
+
+			const std::uint64_t expected = per_producer * producers;
+			result.completed = WaitFor([&pool, expected]() { return pool.received >= expected; }, 120.0);
+			result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+
+			ClientPoolMetricsSnapshot metrics = pool.GetMetrics();
+			result.msgs = pool.received;
+			result.bytes = result.msgs * size;
+			result.latency = pool.latency.Snapshot();
+
+			std::ostringstream notes;
+			notes << "round trips, " << metrics.connected << " of " << metrics.connections << " connected, "
+				<< metrics.clients.writes << " writes, " << rejected << " sends rejected";
+			result.notes = notes.str();
+			results.push_back(result);
+		}
+		return results;
+	}
+
+	// A price update the way a feed would send it, text with the same field names
+	// and instrument codes over and over, behind the usual time stamp
+	static std::string make_quote(std::uint64_t i)
+	{
+		static const char* instruments[] = { "HSIZ4", "HHIZ4", "MHIZ4", "HSIF5" };
+		std::ostringstream quote;
+		quote << "instrument=" << instruments[i % 4]
+			<< " bid_price=" << 19990 + i % 17 << " bid_qty=" << 1 + i % 50
+			<< " ask_price=" << 20001 + i % 13 << " ask_qty=" << 1 + i % 40
+			<< " last_price=" << 19995 + i % 11 << " volume=" << 100000 + i * 3
+			<< " status=TRADING";
+
+		std::string payload = MakePayload(sizeof(std::uint64_t));
+		return payload + quote.str();
+	}
+
+	std::vector<BenchResult> RunCompress(BenchOptions& options)
+	{
+		// The same broadcasts with and without compression. MB/s is what went over
+		// the wire, compressed once per broadcast however many subscribers there are.
+		std::vector<BenchResult> results;
+		if (!CompressionAvailable())
+		{
+			BenchResult result;
+			result.scenario = "compress";
+			result.notes = "skipped, built without SPSOCKET_WITH_ZLIB";
+			results.push_back(result);
+			return results;
+		}
+
+		const std::uint64_t msgs = options.quick ? 2000 : 10000;
+		const std::string dictionary =
+			"instrument=HSIZ4 instrument=HHIZ4 instrument=MHIZ4 instrument=HSIF5 "
+			"bid_price= bid_qty= ask_price= ask_qty= last_price= volume= status=TRADING";
+
+		for (std::size_t subscribers : { 10, 100 })
+		{
+			for (bool compress : { false, true })
+			{
+				BenchResult result;
+				result.scenario = "compress";
+				result.config = config_name("subs", subscribers, "zlib", compress ? 1 : 0);
+
+				BenchHarness harness(BenchMode::M_SINK, options.base_port++, options.server_threads, options.client_threads,
+					std::vector<udp::endpoint>(), compress ? dictionary : std::string());
+				if (!harness.AddClients(subscribers))
+				{
+					result.completed = false;
+					results.push_back(result);
+					continue;
+				}
+
+				// The clients ask for compression right after connecting, let the server see it.
+				BenchServer& server = harness.Server();
+				WaitFor([&server, compress, subscribers]()
+				{
+					return !compress || server.GetMetrics().compressed_sessions >= subscribers;
+				}, 10.0);
+
+				std::uint64_t payload_bytes = 0;
+				auto t0 = std::chrono::steady_clock::now();
+				for (std::uint64_t i = 0; i < msgs; ++i)
+				{
+					std::string quote = make_quote(i);
+					payload_bytes += quote.size();
+					server.BroadCast(quote);
+				}
+
+				auto& all = harness.Clients();
+				result.completed = WaitFor([&all, msgs]()
+				{
+					for (auto& client : all)
+					{
+						if (client->received < msgs)
+							return false;
+					}
+					return true;
+				}, 120.0);
+				result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+
+				std::uint64_t wire_bytes = 0;
+				for (auto& client : all)
+					wire_bytes += client->GetMetrics().bytes_in;
+
+				result.msgs = msgs * subscribers;
+				result.bytes = wire_bytes;
+				result.latency = harness.ClientLatency().Snapshot();
+
+				ServerMetricsSnapshot metrics = server.GetMetrics();
+				std::ostringstream notes;
+				notes << std::fixed << std::setprecision(1)
+					<< "wire B/msg=" << double(wire_bytes) / double(result.msgs)
+					<< " payload B/msg=" << double(payload_bytes) / double(msgs)
+					<< " compressed=" << metrics.compressed;
+				result.notes = notes.str();
+				results.push_back(result);
+			}
+		}
+		return results;
+	}
+
+	std::vector<BenchResult> RunTeardown(BenchOptions& options)
+	{
+		// A server with its sessions on a pool destroyed while clients are still
+		// connected and broadcasts are still being written to them. It must go
+		// without a crash and every client must see its connection close.
+		std::vector<BenchResult> results;
+		const std::size_t size = 1024;
+		const std::uint64_t burst = options.quick ? 2000 : 20000;
+
+		for (std::size_t clients : { 16, 256 })
+		{
+			BenchResult result;
+			result.scenario = "teardown";
+			result.config = config_name("clients", clients);
+
+			const unsigned short port = options.base_port++;
+			boost::asio::io_context acceptor_context;
+			std::unique_ptr<BenchServer> server(new BenchServer(acceptor_context,
+				tcp::endpoint(tcp::v4(), port),
+				udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 9),
+				BenchMode::M_SINK));
+			server->UseLengthPrefix();
+			server->UseIOContextPool(std::max<std::size_t>(options.server_threads, 2), false);
+			server->StartServer();
+			std::thread acceptor_thread([&acceptor_context]() { acceptor_context.run(); });
+
+			BenchPool pool(options.client_threads > 0 ? options.client_threads : 1);
+			pool.UseLengthPrefix();
+			pool.Connect("127.0.0.1", port, clients);
+
+			BenchServer& s = *server;
+			result.completed = WaitFor([&pool, &s, clients]()
+			{
+				return pool.ConnectedCount() == clients && s.connected >= static_cast<int>(clients);
+			}, 30.0);
+
+			auto t0 = std::chrono::steady_clock::now();
+			if (result.completed)
+			{
+				for (std::uint64_t i = 0; i < burst; ++i)
+					server->BroadCast(MakePayload(size));
+				result.completed = WaitFor([&pool]() { return pool.received > 0; }, 10.0);
+			}
+			const std::uint64_t received_before = pool.received;
+
+			// Nothing but the acceptor's thread goes first, the pool is still running.
+			acceptor_context.stop();
+			acceptor_thread.join();
+			server.reset();
+
+			const bool closed = WaitFor([&pool]() { return pool.ConnectedCount() == 0; }, 10.0);
+			result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+			result.msgs = pool.received;
+			result.bytes = result.msgs * size;
+			result.latency = pool.latency.Snapshot();
+
+			std::ostringstream notes;
+			notes << received_before << " received before and " << pool.received - received_before
+				<< " after the server went, " << pool.ConnectedCount() << " of " << clients << " still connected";
+			if (!closed)
+			{
+				result.passed = false;
+				notes << " FAIL: the clients did not see the server go";
+			}
+			result.notes = notes.str();
+			results.push_back(result);
+		}
+		return results;
+	}
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+	std::vector<BenchResult> RunCoEcho(BenchOptions& options)
+	{
+		// The echo matrix again, answered by a session coroutine instead of a
+		// TCP_Session. The clients are the same callback clients as in echo.
+		std::vector<BenchResult> results;
+		const std::uint64_t total = options.quick ? 20000 : 100000;
+
+		for (std::size_t clients : { 1, 16 })
+		{
+			for (std::size_t size : { 64, 1024 })
+			{
+				BenchResult result;
+				result.scenario = "coecho";
+				result.config = config_name("clients", clients, "size", size);
+
+				BenchHarness harness(BenchMode::M_CO_ECHO, options.base_port++, options.server_threads, options.client_threads);
+				if (!harness.AddClients(clients))
+				{
+					result.completed = false;
+					results.push_back(result);
+					continue;
+				}
+
+				auto& all = harness.Clients();
+				auto all_received = [&all](std::uint64_t n)
+				{
+					for (auto& client : all)
+					{
+						if (client->received < n)
+							return false;
+					}
+					return true;
+				};
+
+				// A few round trips first, so the session threads have the frames and
+				// operation state in their recycling caches, then the measured run.
+				const std::uint64_t warmup = 10;
+				for (auto& client : all)
+				{
+					client->UseEcho(size, warmup - 1);
+					client->Send(MakePayload(size));
+				}
+				if (!WaitFor([&all_received, warmup]() { return all_received(warmup); }, 120.0))
+				{
+					result.completed = false;
+					results.push_back(result);
+					continue;
+				}
+
+				const std::uint64_t per_client = total / clients;
+				std::uint64_t allocations = g_flagged_allocations.load(std::memory_order_relaxed);
+				auto t0 = std::chrono::steady_clock::now();
+				for (auto& client : all)
+				{
+					client->UseEcho(size, per_client - 1);
+					client->Send(MakePayload(size));
+				}
+
+				result.completed = WaitFor([&all_received, warmup, per_client]() { return all_received(warmup + per_client); }, 120.0);
+
+				result.seconds = seconds_between(t0, std::chrono::steady_clock::now());
+				allocations = g_flagged_allocations.load(std::memory_order_relaxed) - allocations;
+				result.msgs = per_client * clients;
+				result.bytes = result.msgs * size;
+				result.latency = harness.ClientLatency().Snapshot();
+
+				// The session coroutines' allocations only, the clients run on
+				// threads of their own. A steady echo loop must not allocate.
+				if (allocations > 0)
+					result.passed = false;
+
+				std::ostringstream notes;
+				notes << std::fixed << std::setprecision(2)
+					<< "latency = round trip, session allocs/msg=" << double(allocations) / double(result.msgs);
+				result.notes = notes.str();
+				results.push_back(result);
+			}
+		}
+		return results;
+	}
+#endif
+
+	//----------------------------------------------------------------------
+
+	void PrintHeader()
+	{
+		std::cout << std::left
+			<< std::setw(11) << "scenario"
+			<< std::setw(20) << "config"
+			<< std::right
+			<< std::setw(12) << "msgs/s"
+			<< std::setw(10) << "MB/s"
+			<< std::setw(11) << "p50 us"
+			<< std::setw(11) << "p99 us"
+			<< std::setw(11) << "p999 us"
+			<< "  notes" << std::endl;
+	}
+
+	void PrintResult(const BenchResult& result)
+	{
+		double seconds = result.seconds > 0 ? result.seconds : 1.0;
+
+		std::cout << std::left
+			<< std::setw(11) << result.scenario
+			<< std::setw(20) << result.config
+			<< std::right << std::fixed
+			<< std::setprecision(0) << std::setw(12) << double(result.msgs) / seconds
+			<< std::setprecision(1) << std::setw(10) << double(result.bytes) / seconds / (1024.0 * 1024.0)
+			<< std::setw(11) << result.latency.Percentile(0.50) / 1000.0
+			<< std::setw(11) << result.latency.Percentile(0.99) / 1000.0
+			<< std::setw(11) << result.latency.Percentile(0.999) / 1000.0
+			<< "  " << (result.completed ? "" : "INCOMPLETE ") << (result.passed ? "" : "FAIL ") << result.notes << std::endl;
+	}
+}
@@ -0,0 +1,239 @@
+#ifndef SAMPLE_BENCHMARK_H
+#define SAMPLE_BENCHMARK_H
+
+#include "../SRC/SPSocketClient.h"
+#include "../SRC/SPSocketClientPool.h"
+#include "../SRC/SPSocketIOContextPool.h"
+#include "../SRC/SPSocketMetrics.h"
+#include "../SRC/SPSocketServer.h"
+#include "../SRC/SPSocketUDPClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace SPSocket
+{
+	// Process-wide count of operator new calls, maintained by Sample.cpp
+	extern std::atomic<std::uint64_t> g_allocations;
+
+	// ... of those made on threads that flagged themselves, e.g. the ones running
+	// the session coroutines of coecho
+	extern std::atomic<std::uint64_t> g_flagged_allocations;
+	extern thread_local bool t_count_allocations;
+
+	// Every payload starts with the steady_clock time it was created at, in ns, so
+	// the receiving side of the same process can tell its latency.
+	std::uint64_t NowNs();
+	std::string MakePayload(std::size_t size);
+	std::uint64_t PayloadAge(std::string_view payload);
+
+	enum class BenchMode
+	{
+		M_SINK,		// count what arrives, record its latency
+		M_ECHO,		// send every message straight back to its sender
+		M_CO_ECHO	// the same from a session coroutine, C++20 builds only
+	};
+
+	class BenchServer : public SPSocketServer {
+	public:
+
+		explicit BenchServer(boost::asio::io_context& io_context, const tcp::endpoint& listen_endpoint, const udp::endpoint& broadcast_endpoint, BenchMode mode)
+			: SPSocketServer(io_context, listen_endpoint, broadcast_endpoint), mode_(mode)
+		{ };
+
+		void OnServerStarted() override {}
+		void OnServerStopped() override {}
+		void OnClientConnected(const std::string& /*host*/, unsigned short /*port*/) override { ++connected; }
+		void OnClientDisconnected(const std::string& /*host*/, unsigned short /*port*/) override { ++disconnected; }
+		void OnReceiveError(const std::string& /*msg*/) override {}
+		void OnReceive(const std::string& /*msg*/) override {}
+		void OnReceiveBatch(const SessionHandle& session, const std::vector<std::string_view>& msgs) override;
+
+		std::atomic<int> connected{ 0 };
+		std::atomic<int> disconnected{ 0 };
+		std::atomic<std::uint64_t> received{ 0 };
+		std::atomic<std::uint64_t> received_bytes{ 0 };
+		Histogram latency{ Histogram::shared_shard_count };
+
+	private:
+
+		BenchMode mode_;
+	};
+
+	class BenchClient : public SPSocketClient {
+	public:
+
+		explicit BenchClient(boost::asio::io_context& io_context, Histogram& latency)
+			: SPSocketClient(io_context), latency_(latency)
+		{ };
+
+		// Ping-pong: sends the next message of this size whenever one comes back
+		void UseEcho(std::size_t payload_size, std::uint64_t count) { echo_size_ = payload_size; echo_remaining_ = count; }
+
+		void OnConnecting(const endpoint_type& /*ep*/) override {}
+		void OnConnected(const endpoint_type& /*ep*/) override {}
+		void OnConnectTimedOut(const endpoint_type& /*ep*/) override {}
+		void OnConnectionError(const std::string& /*msg*/) override {}
+		void OnHeartBeatError(const std::string& /*msg*/) override {}
+		void OnReceiveTimeOut(const std::string& /*msg*/) override {}
+		void OnReceiveError(const std::string& /*msg*/) override {}
+		void OnReceive(const std::string& /*msg*/) override {}
+		void OnSendError(const std::string& /*msg*/) override {}
+		void OnDisconnected() override {}
+		void OnReceiveView(std::string_view msg) override;
+
+		std::atomic<std::uint64_t> received{ 0 };
+		std::atomic<std::uint64_t> received_bytes{ 0 };
+
+	private:
+
+		Histogram& latency_;
+		std::size_t echo_size_ = 0;
+		std::uint64_t echo_remaining_ = 0;
+	};
+
+	// Counts and times what comes back on any of its connections
+	class BenchPool : public SPSocketClientPool {
+	public:
+
+		explicit BenchPool(std::size_t thread_count)
+			: SPSocketClientPool(thread_count, false)
+		{ };
+
+		~BenchPool() noexcept { Stop(); }
+
+		void OnReceive(std::size_t connection, std::string_view msg) override;
+
+		std::atomic<std::uint64_t> received{ 0 };
+		Histogram latency{ Histogram::shared_shard_count };
+	};
+
+	// Receives the server's UDP feed, one per endpoint, each on its own io_context.
+	// Times what arrives into a histogram shared by all of them and keeps the
+	// ranges reported by OnGap.
+	class BenchFeed : public SPSocketUDPClient {
+	public:
+
+		explicit BenchFeed(boost::asio::io_context& io_context, Histogram& latency)
+			: SPSocketUDPClient(io_context), latency_(latency)
+		{ };
+
+		void OnReceiveError(const std::string& /*msg*/) override {}
+		void OnReceive(const std::string& /*msg*/) override {}
+		void OnReceiveView(std::string_view msg) override { latency_.Record(PayloadAge(msg)); }
+		void OnGap(std::uint64_t first_missing, std::uint64_t next_received) override;
+
+		// Messages missing according to the OnGap calls
+		std::atomic<std::uint64_t> gap_lost{ 0 };
+
+	private:
+
+		Histogram& latency_;
+	};
+
+	//
+	// One server on loopback plus any number of clients, all with length-prefixed
+	// framing, torn down again on destruction. The server runs its acceptor on its
+	// own thread and, if server_threads > 0, its sessions on a pool of that many
+	// threads. The clients share a pool of client_threads. Broadcasts also go out
+	// over UDP, to udp_endpoints or else to the discard port. With a dictionary
+	// the clients ask for compressed messages.
+	//
+	class BenchHarness {
+	public:
+
+		BenchHarness(BenchMode mode, unsigned short port, std::size_t server_threads, std::size_t client_threads,
+			const std::vector<udp::endpoint>& udp_endpoints = std::vector<udp::endpoint>(),
+			const std::string& dictionary = std::string());
+		~BenchHarness() noexcept;
+
+		BenchServer& Server() { return *server_; }
+
+		// Connects n more clients, returns false if they did not all get connected in time
+		bool AddClients(std::size_t n);
+
+		std::vector<std::unique_ptr<BenchClient>>& Clients() { return clients_; }
+
+		// Latency of everything received by the clients
+		Histogram& ClientLatency() { return client_latency_; }
+
+		unsigned short Port() const { return port_; }
+
+	private:
+
+		unsigned short port_;
+		std::string dictionary_;
+
+		boost::asio::io_context server_context_;
+		IOContextPool client_pool_;
+		Histogram client_latency_{ Histogram::shared_shard_count };
+
+		std::unique_ptr<BenchServer> server_;
+		std::vector<std::unique_ptr<BenchClient>> clients_;
+		std::thread server_thread_;
+	};
+
+	//----------------------------------------------------------------------
+
+	struct BenchResult {
+		std::string scenario;
+		std::string config;
+		std::uint64_t msgs = 0;
+		std::uint64_t bytes = 0;
+		double seconds = 0;
+		HistogramSnapshot latency;
+		std::string notes;
+		bool completed = true;
+		bool passed = true;			// false if the scenario's own check failed, see notes
+	};
+
+	struct BenchOptions {
+		bool quick = false;
+		std::size_t server_threads = 0;		// 0 = sessions run on the acceptor's thread
+		std::size_t client_threads = 1;
+		unsigned short base_port = 19500;
+	};
+
+	// Polls pred every millisecond until it holds or the timeout passes
+	template <typename Pred>
+	bool WaitFor(Pred pred, double timeout_sec = 30.0)
+	{
+		auto until = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout_sec);
+		while (!pred())
+		{
+			if (std::chrono::steady_clock::now() > until)
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return true;
+	}
+
+	// The scenarios, each runs its whole size / concurrency matrix
+	std::vector<BenchResult> RunEcho(BenchOptions& options);
+	std::vector<BenchResult> RunFanOut(BenchOptions& options);
+	std::vector<BenchResult> RunFlood(BenchOptions& options);
+	std::vector<BenchResult> RunStream(BenchOptions& options);
+	std::vector<BenchResult> RunChurn(BenchOptions& options);
+	std::vector<BenchResult> RunProducers(BenchOptions& options);
+	std::vector<BenchResult> RunUdp(BenchOptions& options);
+	BenchResult RunUdpGaps(BenchOptions& options);	// part of RunUdp
+	std::vector<BenchResult> RunReconnect(BenchOptions& options);
+	BenchResult RunReconnectFailover(BenchOptions& options);	// part of RunReconnect
+	std::vector<BenchResult> RunPool(BenchOptions& options);
+	std::vector<BenchResult> RunCompress(BenchOptions& options);
+	std::vector<BenchResult> RunTeardown(BenchOptions& options);
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+	std::vector<BenchResult> RunCoEcho(BenchOptions& options);
+#endif
+
+	void PrintHeader();
+	void PrintResult(const BenchResult& result);
+}
+
+#endif
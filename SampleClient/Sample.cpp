@@ -26,9 +26,7 @@ int main(int argc, char* argv[])
 		std::string line;
 		std::getline(std::cin, line);
 		line.append("\n");	// tag back along the newline char
-		sc.Send(line);
-
-		Sleep(5);	// need to delay some time between getline and send otherwise program will blow up!
+		sc.Send(line);		// queued and written by the io_context thread, no delay needed
 	}
 	sc.Disconnect();
 	io_context.stop();
@@ -17,6 +17,7 @@ int main(int argc, char* argv[])
     udp::endpoint broadcast_endpoint(boost::asio::ip::make_address(SERVER_HOST), 0);
 
     SampleServer ss(io_context, listen_endpoint, broadcast_endpoint);
+    //ss.UseIOContextPool();	// one io_context per core, config any setting here
     ss.StartServer();
 
     boost::thread sampleThread{ []() { io_context.run(); } };
@@ -26,9 +27,7 @@ int main(int argc, char* argv[])
         std::string line;
         std::getline(std::cin, line);
         line.append("\n");	// tag back along the newline char
-        ss.BroadCast(line);
-
-        Sleep(5);	// need to delay some time between getline and send otherwise program will blow up!
+        ss.BroadCast(line);	// queued and delivered by the io_context thread, no delay needed
     }
     ss.StopServer();
     io_context.stop();